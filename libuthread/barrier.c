@@ -0,0 +1,199 @@
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "barrier.h"
+#include "futex.h"
+
+/* Size of a cache line, so that counters of the tree never share one */
+#define BARRIER_CACHELINE	64
+
+/* Number of arrivals combined by each counter of the tree */
+#define BARRIER_FANIN	4
+
+/*
+ * A counter of the tree. The phase is complete at this node once @quota
+ * threads (for a leaf) or children (for an inner node) have arrived, and the
+ * thread completing it carries on to @parent (-1 for the root).
+ */
+struct barrier_node {
+	_Alignas(BARRIER_CACHELINE) atomic_int count;
+	int quota;
+	int parent;
+};
+
+/*
+ * Arriving threads pick a leaf with room left, starting from a leaf of their
+ * own, and the last thread to arrive at a node moves up to its parent. The
+ * thread completing the root resets the counters and then increments @phase,
+ * which is the futex word all the other threads sleep on: they are all woken
+ * up by a single system call.
+ *
+ * Without BARRIER_TREE, there is a single node, the root, whose quota is the
+ * number of threads.
+ */
+struct barrier {
+	_Alignas(BARRIER_CACHELINE) atomic_int phase;
+	int nleaves;
+	int nnodes;
+	struct barrier_node *nodes;
+};
+
+/* Leaf hint of the calling thread, plus one (0 until first used) */
+static __thread unsigned int barrier_hint;
+static atomic_uint barrier_next_hint;
+
+#define min(x, y) (((x) <= (y)) ? (x) : (y))
+
+/*
+ * Register the arrival of the calling thread. Return 1 if it was the last
+ * thread to arrive, 0 otherwise.
+ */
+static int barrier_arrive(barrier_t barrier)
+{
+	struct barrier_node *node;
+	int i, k, count;
+
+	if (barrier_hint == 0) {
+		barrier_hint = atomic_fetch_add_explicit(&barrier_next_hint, 1,
+							 memory_order_relaxed)
+			/ BARRIER_FANIN + 1;
+	}
+
+	/* Find a leaf with room left, there is always one */
+	for (k = 0; ; k++) {
+		i = (barrier_hint - 1 + k) % barrier->nleaves;
+		node = &barrier->nodes[i];
+
+		count = atomic_load(&node->count);
+		while (count < node->quota) {
+			if (atomic_compare_exchange_weak(&node->count, &count,
+							 count + 1)) {
+				goto arrived;
+			}
+		}
+	}
+
+arrived:
+	if (count + 1 < node->quota) {
+		return 0;
+	}
+
+	/* Last at this leaf: carry on to the root */
+	for (i = node->parent; i >= 0; i = barrier->nodes[i].parent) {
+		node = &barrier->nodes[i];
+		if (atomic_fetch_add(&node->count, 1) + 1 < node->quota) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/***** API Definitions *****/
+barrier_t barrier_create(size_t count, int flags)
+{
+	barrier_t new_barrier;
+	int fanin, nnodes, base, m, i;
+
+	if (count == 0 || count > INT_MAX) {
+		return NULL;
+	}
+
+	/* A single node is a tree whose root takes every thread */
+	fanin = (flags & BARRIER_TREE) ? BARRIER_FANIN : count;
+
+	nnodes = 0;
+	for (m = (count + fanin - 1) / fanin; m > 1; m = (m + fanin - 1) / fanin) {
+		nnodes += m;
+	}
+	nnodes++;
+
+	new_barrier = (barrier_t) aligned_alloc(BARRIER_CACHELINE,
+						 sizeof(struct barrier));
+	if (new_barrier == NULL) {
+		return NULL;
+	}
+
+	new_barrier->nodes = aligned_alloc(BARRIER_CACHELINE,
+					   nnodes * sizeof(struct barrier_node));
+	if (new_barrier->nodes == NULL) {
+		free(new_barrier);
+		return NULL;
+	}
+
+	/* Leaves take threads, each level above takes the nodes below */
+	new_barrier->nleaves = (count + fanin - 1) / fanin;
+	new_barrier->nnodes = nnodes;
+	for (base = 0, m = count; base < nnodes; m = (m + fanin - 1) / fanin) {
+		int level = (m + fanin - 1) / fanin;
+
+		for (i = 0; i < level; i++) {
+			struct barrier_node *node = &new_barrier->nodes[base + i];
+
+			atomic_init(&node->count, 0);
+			node->quota = min(fanin, m - i * fanin);
+			node->parent = (level > 1) ? base + level + i / fanin : -1;
+		}
+		base += level;
+	}
+
+	atomic_init(&new_barrier->phase, 0);
+
+	return new_barrier;
+}
+
+int barrier_destroy(barrier_t barrier)
+{
+	int i;
+
+	/* Check for NULL barrier */
+	if (barrier == NULL) {
+		return -1;
+	}
+
+	/* Check for waiting threads */
+	for (i = 0; i < barrier->nleaves; i++) {
+		if (atomic_load(&barrier->nodes[i].count) != 0) {
+			return -1;
+		}
+	}
+
+	free(barrier->nodes);
+	free(barrier);
+
+	return 0;
+}
+
+int barrier_wait(barrier_t barrier)
+{
+	int phase, i;
+
+	/* Check for NULL barrier */
+	if (barrier == NULL) {
+		return -1;
+	}
+
+	phase = atomic_load(&barrier->phase);
+
+	if (!barrier_arrive(barrier)) {
+		/* Sleep until the last thread moves on to the next phase */
+		while (atomic_load(&barrier->phase) == phase) {
+			futex_wait(&barrier->phase, phase);
+		}
+		return 0;
+	}
+
+	/* Everybody is waiting for us, so nobody else touches the counters */
+	for (i = 0; i < barrier->nnodes; i++) {
+		atomic_store_explicit(&barrier->nodes[i].count, 0,
+				      memory_order_relaxed);
+	}
+
+	/* Release everybody at once */
+	atomic_fetch_add(&barrier->phase, 1);
+	futex_wake(&barrier->phase, INT_MAX);
+
+	return BARRIER_SERIAL;
+}
@@ -0,0 +1,64 @@
+#ifndef _BARRIER_H
+#define _BARRIER_H
+
+#include <stddef.h>
+
+/*
+ * barrier_t - Barrier type
+ *
+ * A barrier synchronizes a fixed number of threads working in phases: each
+ * thread calling barrier_wait() is blocked until all the threads have called
+ * it, at which point they are all released at once and the barrier is ready
+ * for the next phase.
+ */
+typedef struct barrier *barrier_t;
+
+/*
+ * Barrier flags
+ *
+ * BARRIER_TREE: Combine arrivals in a tree of counters instead of a single
+ * one. Each counter is only shared by a few threads, which avoids having all
+ * the threads contend on the same cache line when many of them arrive at the
+ * same time. The release is a single broadcast either way.
+ */
+#define BARRIER_TREE	0x1
+
+/*
+ * BARRIER_SERIAL - Return value of barrier_wait() for the last thread to arrive
+ */
+#define BARRIER_SERIAL	1
+
+/*
+ * barrier_create - Create barrier
+ * @count: Number of threads to synchronize
+ * @flags: Barrier flags (e.g. BARRIER_TREE)
+ *
+ * Allocate and initialize a barrier for @count threads.
+ *
+ * Return: Pointer to initialized barrier. NULL if @count is 0 or does not fit
+ * in an int, or in case of failure when allocating the new barrier.
+ */
+barrier_t barrier_create(size_t count, int flags);
+
+/*
+ * barrier_destroy - Deallocate a barrier
+ * @barrier: Barrier to deallocate
+ *
+ * Return: -1 if @barrier is NULL or if threads are still waiting on @barrier.
+ * 0 if @barrier was successfully destroyed.
+ */
+int barrier_destroy(barrier_t barrier);
+
+/*
+ * barrier_wait - Wait on a barrier
+ * @barrier: Barrier to wait on
+ *
+ * Block the calling thread until all the threads synchronized by @barrier have
+ * called barrier_wait() for the current phase.
+ *
+ * Return: -1 if @barrier is NULL. BARRIER_SERIAL for the last thread to arrive,
+ * which released the others, and 0 for the others.
+ */
+int barrier_wait(barrier_t barrier);
+
+#endif /* _BARRIER_H */
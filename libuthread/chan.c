@@ -0,0 +1,263 @@
+#include <limits.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "chan.h"
+#include "sem.h"
+
+/* Size of a cache line, to keep indices written by different threads apart */
+#define CHAN_CACHELINE	64
+
+/*
+ * A slot of the ring. @seq tells which position the slot is ready for: a
+ * sender reserving position p waits for @seq == p before storing its item and
+ * setting @seq to p + 1, and a receiver reserving position p waits for
+ * @seq == p + 1 before reading the item and setting @seq to p + size, i.e. the
+ * next position mapped to this slot.
+ */
+struct chan_cell {
+	atomic_size_t seq;
+	void *item;
+};
+
+/*
+ * The semaphores count free slots (@room) and buffered items (@items), so that
+ * blocked senders and receivers sleep exactly like semaphore waiters. Once a
+ * thread has taken k units from one of them, it owns k positions of the ring,
+ * which it reserves with a single atomic increment of @tail or @head. The ring
+ * itself is never locked.
+ *
+ * Each semaphore and each index lives on its own cache line, since @tail is
+ * only written by senders and @head by receivers.
+ */
+struct chan {
+	struct semaphore room;
+	_Alignas(CHAN_CACHELINE) struct semaphore items;
+	_Alignas(CHAN_CACHELINE) atomic_size_t tail;
+	_Alignas(CHAN_CACHELINE) atomic_size_t head;
+	_Alignas(CHAN_CACHELINE) size_t capacity;
+	size_t mask;
+	struct chan_cell *cells;
+};
+
+/*
+ * Wait until @cell is ready for position @seq. The semaphores guarantee that
+ * the slot is free (or full), but the thread which last owned it may still be
+ * in the middle of accessing it.
+ */
+static void chan_wait_cell(struct chan_cell *cell, size_t seq)
+{
+	while (atomic_load_explicit(&cell->seq, memory_order_acquire) != seq) {
+		sched_yield();
+	}
+}
+
+/* Store @n items into positions reserved after having taken @n units of room */
+static void chan_put(chan_t chan, void **items, size_t n)
+{
+	size_t pos, i;
+
+	pos = atomic_fetch_add_explicit(&chan->tail, n, memory_order_relaxed);
+
+	for (i = 0; i < n; i++, pos++) {
+		struct chan_cell *cell = &chan->cells[pos & chan->mask];
+
+		chan_wait_cell(cell, pos);
+		cell->item = items[i];
+		atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+	}
+
+	sem_up_n(&chan->items, n);
+}
+
+/* Load @n items from positions reserved after having taken @n items */
+static void chan_get(chan_t chan, void **items, size_t n)
+{
+	size_t pos, i;
+
+	pos = atomic_fetch_add_explicit(&chan->head, n, memory_order_relaxed);
+
+	for (i = 0; i < n; i++, pos++) {
+		struct chan_cell *cell = &chan->cells[pos & chan->mask];
+
+		chan_wait_cell(cell, pos + 1);
+		items[i] = cell->item;
+		atomic_store_explicit(&cell->seq, pos + chan->mask + 1,
+				      memory_order_release);
+	}
+
+	sem_up_n(&chan->room, n);
+}
+
+/***** API Definitions *****/
+chan_t chan_create(size_t capacity)
+{
+	chan_t new_chan;
+	size_t size, i;
+
+	if (capacity == 0 || capacity > INT_MAX) {
+		return NULL;
+	}
+
+	/* Round the ring up to a power of two, so positions map with a mask */
+	for (size = 1; size < capacity; size *= 2) {
+	}
+
+	new_chan = (chan_t) aligned_alloc(CHAN_CACHELINE, sizeof(struct chan));
+	if (new_chan == NULL) {
+		return NULL;
+	}
+
+	new_chan->cells = malloc(size * sizeof(struct chan_cell));
+	if (new_chan->cells == NULL) {
+		free(new_chan);
+		return NULL;
+	}
+
+	for (i = 0; i < size; i++) {
+		atomic_init(&new_chan->cells[i].seq, i);
+	}
+
+	if (sem_init(&new_chan->room, capacity)) {
+		free(new_chan->cells);
+		free(new_chan);
+		return NULL;
+	} else if (sem_init(&new_chan->items, 0)) {
+		sem_fini(&new_chan->room);
+		free(new_chan->cells);
+		free(new_chan);
+		return NULL;
+	}
+
+	atomic_init(&new_chan->tail, 0);
+	atomic_init(&new_chan->head, 0);
+	new_chan->capacity = capacity;
+	new_chan->mask = size - 1;
+
+	return new_chan;
+}
+
+int chan_destroy(chan_t chan)
+{
+	/*
+	 * Check for NULL chan or waiting threads, on both semaphores before
+	 * finalizing either, so that a failure leaves the channel usable
+	 */
+	if (chan == NULL) {
+		return -1;
+	} else if (atomic_load(&chan->room.waiters) != 0
+		   || atomic_load(&chan->items.waiters) != 0) {
+		return -1;
+	}
+
+	sem_fini(&chan->room);
+	sem_fini(&chan->items);
+
+	free(chan->cells);
+	free(chan);
+
+	return 0;
+}
+
+int chan_send(chan_t chan, void *item)
+{
+	/* Check for NULL chan */
+	if (chan == NULL) {
+		return -1;
+	}
+
+	sem_down(&chan->room);
+	chan_put(chan, &item, 1);
+
+	return 0;
+}
+
+int chan_trysend(chan_t chan, void *item)
+{
+	/* Check for NULL chan or full channel */
+	if (chan == NULL || sem_trydown(&chan->room)) {
+		return -1;
+	}
+
+	chan_put(chan, &item, 1);
+
+	return 0;
+}
+
+int chan_send_n(chan_t chan, void **items, size_t n)
+{
+	size_t batch;
+
+	/* Check for NULL chan or items */
+	if (chan == NULL || items == NULL) {
+		return -1;
+	}
+
+	/* A batch cannot wait for more room than the whole channel */
+	while (n > 0) {
+		batch = (n < chan->capacity) ? n : chan->capacity;
+		sem_down_n(&chan->room, batch);
+		chan_put(chan, items, batch);
+		items += batch;
+		n -= batch;
+	}
+
+	return 0;
+}
+
+int chan_recv(chan_t chan, void **item)
+{
+	/* Check for NULL chan or item */
+	if (chan == NULL || item == NULL) {
+		return -1;
+	}
+
+	sem_down(&chan->items);
+	chan_get(chan, item, 1);
+
+	return 0;
+}
+
+int chan_tryrecv(chan_t chan, void **item)
+{
+	/* Check for NULL chan or item, or empty channel */
+	if (chan == NULL || item == NULL || sem_trydown(&chan->items)) {
+		return -1;
+	}
+
+	chan_get(chan, item, 1);
+
+	return 0;
+}
+
+int chan_recv_n(chan_t chan, void **items, size_t n)
+{
+	int taken;
+
+	/* Check for NULL chan or items */
+	if (chan == NULL || items == NULL) {
+		return -1;
+	} else if (n == 0) {
+		return 0;
+	}
+
+	/* Wait for one item, then grab whatever else is already there */
+	sem_down(&chan->items);
+	taken = 1 + sem_down_upto(&chan->items, n - 1);
+	chan_get(chan, items, taken);
+
+	return taken;
+}
+
+int chan_getvalue(chan_t chan, int *sval)
+{
+	/* Check for NULL chan or sval */
+	if (chan == NULL || sval == NULL) {
+		return -1;
+	}
+
+	/* Items ready to be received, or receivers waiting for one */
+	return sem_getvalue(&chan->items, sval);
+}
@@ -0,0 +1,132 @@
+#ifndef _CHAN_H
+#define _CHAN_H
+
+#include <stddef.h>
+
+/*
+ * chan_t - Channel type
+ *
+ * A channel is a bounded first-in first-out buffer of pointers, through which
+ * any number of producer threads can send items to any number of consumer
+ * threads. Sending to a full channel blocks the sender until room is made,
+ * while receiving from an empty channel blocks the receiver until an item is
+ * sent.
+ */
+typedef struct chan *chan_t;
+
+/*
+ * chan_create - Create channel
+ * @capacity: Maximum number of items buffered in the channel
+ *
+ * Allocate and initialize an empty channel able to buffer @capacity items.
+ *
+ * Return: Pointer to initialized channel. NULL if @capacity is 0 or does not
+ * fit in an int, or in case of failure when allocating or initializing the
+ * new channel.
+ */
+chan_t chan_create(size_t capacity);
+
+/*
+ * chan_destroy - Deallocate a channel
+ * @chan: Channel to deallocate
+ *
+ * Deallocate channel @chan. Items still buffered in @chan are dropped.
+ *
+ * Return: -1 if @chan is NULL or if other threads are still being blocked on
+ * @chan. 0 if @chan was successfully destroyed.
+ */
+int chan_destroy(chan_t chan);
+
+/*
+ * chan_send - Send an item
+ * @chan: Channel to send to
+ * @item: Item to send
+ *
+ * Append @item to channel @chan, blocking while @chan is full.
+ *
+ * Return: -1 if @chan is NULL. 0 if @item was successfully sent.
+ */
+int chan_send(chan_t chan, void *item);
+
+/*
+ * chan_trysend - Send an item without blocking
+ * @chan: Channel to send to
+ * @item: Item to send
+ *
+ * Append @item to channel @chan if there is room for it right away.
+ *
+ * Return: -1 if @chan is NULL or if @chan is full. 0 if @item was successfully
+ * sent.
+ */
+int chan_trysend(chan_t chan, void *item);
+
+/*
+ * chan_send_n - Send several items
+ * @chan: Channel to send to
+ * @items: Array of items to send
+ * @n: Number of items in @items
+ *
+ * Append the @n items of @items to channel @chan, in order. Items are sent in
+ * batches as large as possible, each batch waiting for enough room at once,
+ * so that the whole array costs a single wake-up of the receivers when @n is
+ * not larger than the capacity of @chan. Items sent concurrently by other
+ * threads can be interleaved between batches.
+ *
+ * Return: -1 if @chan or @items are NULL. 0 if the items were successfully
+ * sent.
+ */
+int chan_send_n(chan_t chan, void **items, size_t n);
+
+/*
+ * chan_recv - Receive an item
+ * @chan: Channel to receive from
+ * @item: Address of data item where received item is stored
+ *
+ * Remove the oldest item of channel @chan, blocking while @chan is empty.
+ *
+ * Return: -1 if @chan or @item are NULL. 0 if an item was successfully
+ * received.
+ */
+int chan_recv(chan_t chan, void **item);
+
+/*
+ * chan_tryrecv - Receive an item without blocking
+ * @chan: Channel to receive from
+ * @item: Address of data item where received item is stored
+ *
+ * Remove the oldest item of channel @chan if there is one right away.
+ *
+ * Return: -1 if @chan or @item are NULL, or if @chan is empty. 0 if an item was
+ * successfully received.
+ */
+int chan_tryrecv(chan_t chan, void **item);
+
+/*
+ * chan_recv_n - Receive several items
+ * @chan: Channel to receive from
+ * @items: Array where received items are stored
+ * @n: Size of @items
+ *
+ * Remove the oldest items of channel @chan, blocking while @chan is empty, and
+ * then taking all the items already buffered, up to @n, in a single step.
+ *
+ * Return: -1 if @chan or @items are NULL. Number of items received otherwise,
+ * between 1 and @n (0 if @n is 0).
+ */
+int chan_recv_n(chan_t chan, void **items, size_t n);
+
+/*
+ * chan_getvalue - Inspect channel's internal state
+ * @chan: Channel to inspect
+ * @sval: Address of data item where value is received
+ *
+ * If channel @chan holds items, assign their number to data item pointed by
+ * @sval. Otherwise, assign a negative number whose absolute value is the
+ * number of threads currently blocked receiving from @chan.
+ *
+ * Return: -1 if @chan or @sval are NULL. 0 if channel was successfully
+ * inspected.
+ */
+int chan_getvalue(chan_t chan, int *sval);
+
+#endif /* _CHAN_H */
@@ -0,0 +1,88 @@
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Thin wrappers around the futex(2) system call, which glibc does not export.
+ *
+ * These are internal to libuthread and are not part of the library API.
+ */
+
+/*
+ * futex_wait - Sleep on a futex word
+ * @uaddr: Futex word
+ * @val: Expected value of the futex word
+ *
+ * Put the calling thread to sleep as long as @uaddr contains @val. The caller
+ * must always check its condition again upon return, since the function can
+ * also return because of a signal or a spurious wake-up.
+ */
+static inline void futex_wait(atomic_int *uaddr, int val)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/*
+ * futex_timedwait - Sleep on a futex word with a deadline
+ * @uaddr: Futex word
+ * @val: Expected value of the futex word
+ * @abstime: Absolute deadline, measured against CLOCK_REALTIME (NULL for none)
+ *
+ * Same as futex_wait(), but give up once @abstime is reached.
+ *
+ * Return: -1 with errno set to ETIMEDOUT if @abstime was reached, 0 otherwise.
+ */
+static inline int futex_timedwait(atomic_int *uaddr, int val,
+				  const struct timespec *abstime)
+{
+	return syscall(SYS_futex, uaddr,
+		       FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, val,
+		       abstime, NULL, FUTEX_BITSET_MATCH_ANY) == -1 ? -1 : 0;
+}
+
+/*
+ * futex_wake - Wake up threads sleeping on a futex word
+ * @uaddr: Futex word
+ * @nr: Maximum number of threads to wake up (INT_MAX for all of them)
+ */
+static inline void futex_wake(atomic_int *uaddr, int nr)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, nr, NULL, NULL, 0);
+}
+
+/*
+ * futex_timedwait_shared - Sleep on a process-shared futex word with a deadline
+ * @uaddr: Futex word, in memory shared with other processes
+ * @val: Expected value of the futex word
+ * @abstime: Absolute deadline, measured against CLOCK_REALTIME (NULL for none)
+ *
+ * Same as futex_timedwait(), for a futex word that threads of other processes
+ * may wait on or wake up.
+ *
+ * Return: -1 with errno set to ETIMEDOUT if @abstime was reached, 0 otherwise.
+ */
+static inline int futex_timedwait_shared(atomic_int *uaddr, int val,
+					 const struct timespec *abstime)
+{
+	return syscall(SYS_futex, uaddr,
+		       FUTEX_WAIT_BITSET | FUTEX_CLOCK_REALTIME, val, abstime,
+		       NULL, FUTEX_BITSET_MATCH_ANY) == -1 ? -1 : 0;
+}
+
+/*
+ * futex_wake_shared - Wake up threads sleeping on a process-shared futex word
+ * @uaddr: Futex word, in memory shared with other processes
+ * @nr: Maximum number of threads to wake up (INT_MAX for all of them)
+ */
+static inline void futex_wake_shared(atomic_int *uaddr, int nr)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAKE, nr, NULL, NULL, 0);
+}
+
+#endif /* _FUTEX_H */
@@ -0,0 +1,110 @@
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "futex.h"
+#include "latch.h"
+
+/*
+ * @count is the futex word waiting threads sleep on. @waiters tells the thread
+ * opening the latch whether there is anybody to wake up: a waiting thread
+ * first increments @waiters and then checks @count again, while the opening
+ * thread first updates @count and then checks @waiters.
+ */
+struct latch {
+	atomic_int count;
+	atomic_int waiters;
+};
+
+/***** API Definitions *****/
+latch_t latch_create(size_t count)
+{
+	latch_t new_latch;
+
+	if (count > INT_MAX) {
+		return NULL;
+	}
+
+	new_latch = (latch_t) malloc(sizeof(struct latch));
+	if (new_latch == NULL) {
+		return NULL;
+	}
+
+	atomic_init(&new_latch->count, count);
+	atomic_init(&new_latch->waiters, 0);
+
+	return new_latch;
+}
+
+int latch_destroy(latch_t latch)
+{
+	/* Check for NULL latch or waiting threads */
+	if (latch == NULL) {
+		return -1;
+	} else if (atomic_load(&latch->waiters) != 0) {
+		return -1;
+	}
+
+	free(latch);
+
+	return 0;
+}
+
+int latch_count_down(latch_t latch, size_t n)
+{
+	int count;
+
+	/* Check for NULL latch */
+	if (latch == NULL) {
+		return -1;
+	}
+
+	count = atomic_load(&latch->count);
+	do {
+		if (n > (size_t)count) {
+			return -1;
+		}
+	} while (!atomic_compare_exchange_weak(&latch->count, &count,
+					       count - (int)n));
+
+	/* Open: release all the waiting threads at once */
+	if (count - (int)n == 0 && n > 0 && atomic_load(&latch->waiters) != 0) {
+		futex_wake(&latch->count, INT_MAX);
+	}
+
+	return 0;
+}
+
+int latch_wait(latch_t latch)
+{
+	int count;
+
+	/* Check for NULL latch */
+	if (latch == NULL) {
+		return -1;
+	}
+
+	/* Fast path: already open */
+	if (atomic_load(&latch->count) == 0) {
+		return 0;
+	}
+
+	atomic_fetch_add(&latch->waiters, 1);
+	while ((count = atomic_load(&latch->count)) != 0) {
+		futex_wait(&latch->count, count);
+	}
+	atomic_fetch_sub(&latch->waiters, 1);
+
+	return 0;
+}
+
+int latch_trywait(latch_t latch)
+{
+	/* Check for NULL latch or closed latch */
+	if (latch == NULL || atomic_load(&latch->count) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef _LATCH_H
+#define _LATCH_H
+
+#include <stddef.h>
+
+/*
+ * latch_t - Countdown latch type
+ *
+ * A latch is a one-shot gate: it starts with a count, which threads decrement
+ * as they complete their part of some work, and threads waiting on the latch
+ * are all released at once when the count reaches 0. Once open, a latch stays
+ * open.
+ */
+typedef struct latch *latch_t;
+
+/*
+ * latch_create - Create latch
+ * @count: Initial count
+ *
+ * Allocate and initialize a latch with count @count. A latch created with a
+ * count of 0 is already open.
+ *
+ * Return: Pointer to initialized latch. NULL if @count does not fit in an int,
+ * or in case of failure when allocating the new latch.
+ */
+latch_t latch_create(size_t count);
+
+/*
+ * latch_destroy - Deallocate a latch
+ * @latch: Latch to deallocate
+ *
+ * Return: -1 if @latch is NULL or if threads are still waiting on @latch. 0 if
+ * @latch was successfully destroyed.
+ */
+int latch_destroy(latch_t latch);
+
+/*
+ * latch_count_down - Decrement a latch's count
+ * @latch: Latch to decrement
+ * @n: Amount to decrement the count by
+ *
+ * Decrement the count of @latch by @n, and release all the threads waiting on
+ * @latch if it reaches 0.
+ *
+ * Return: -1 if @latch is NULL or if @n is greater than the current count. 0
+ * if the count was successfully decremented.
+ */
+int latch_count_down(latch_t latch, size_t n);
+
+/*
+ * latch_wait - Wait for a latch to open
+ * @latch: Latch to wait on
+ *
+ * Block the calling thread until the count of @latch reaches 0.
+ *
+ * Return: -1 if @latch is NULL. 0 once @latch is open.
+ */
+int latch_wait(latch_t latch);
+
+/*
+ * latch_trywait - Check if a latch is open
+ * @latch: Latch to check
+ *
+ * Return: -1 if @latch is NULL or if its count has not reached 0 yet. 0 if
+ * @latch is open.
+ */
+int latch_trywait(latch_t latch);
+
+#endif /* _LATCH_H */
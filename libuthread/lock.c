@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "futex.h"
+#include "lock.h"
+
+/* Number of attempts at grabbing a busy lock before going to sleep */
+#define LOCK_SPIN 100
+
+/*
+ * Lock states
+ * -LOCK_FREE: Nobody holds the lock
+ * -LOCK_TAKEN: The lock is held and nobody is sleeping on it
+ * -LOCK_SLEEPERS: The lock is held and threads may be sleeping on it
+ */
+enum {
+	LOCK_FREE,
+	LOCK_TAKEN,
+	LOCK_SLEEPERS,
+};
+
+void lock_init(lock_t *lock)
+{
+	atomic_init(&lock->state, LOCK_FREE);
+}
+
+void lock_acquire(lock_t *lock)
+{
+	int state;
+	int i;
+
+	/* Fast path: the lock is free, or gets released shortly */
+	for (i = 0; i < LOCK_SPIN; i++) {
+		state = LOCK_FREE;
+		if (atomic_compare_exchange_weak(&lock->state, &state, LOCK_TAKEN)) {
+			return;
+		} else if (state == LOCK_SLEEPERS) {
+			break;
+		}
+	}
+
+	/*
+	 * Slow path: announce that we are sleeping, so that the owner wakes us
+	 * up upon release
+	 */
+	while (atomic_exchange(&lock->state, LOCK_SLEEPERS) != LOCK_FREE) {
+		futex_wait(&lock->state, LOCK_SLEEPERS);
+	}
+}
+
+void lock_release(lock_t *lock)
+{
+	if (atomic_exchange(&lock->state, LOCK_FREE) == LOCK_SLEEPERS) {
+		futex_wake(&lock->state, 1);
+	}
+}
+
+void waitlist_init(waitlist_t *list)
+{
+	list->head = NULL;
+	list->tail = NULL;
+}
+
+void waitlist_push(waitlist_t *list, waiter_t waiter)
+{
+	waiter->prev = list->tail;
+	waiter->next = NULL;
+	waiter->linked = 1;
+
+	if (list->tail == NULL) {
+		list->head = waiter;
+	} else {
+		list->tail->next = waiter;
+	}
+	list->tail = waiter;
+}
+
+waiter_t waitlist_first(waitlist_t *list)
+{
+	return list->head;
+}
+
+waiter_t waitlist_pop(waitlist_t *list)
+{
+	waiter_t waiter = list->head;
+
+	if (waiter != NULL) {
+		waitlist_remove(list, waiter);
+	}
+
+	return waiter;
+}
+
+int waitlist_remove(waitlist_t *list, waiter_t waiter)
+{
+	if (!waiter->linked) {
+		return -1;
+	}
+
+	if (waiter->prev == NULL) {
+		list->head = waiter->next;
+	} else {
+		waiter->prev->next = waiter->next;
+	}
+
+	if (waiter->next == NULL) {
+		list->tail = waiter->prev;
+	} else {
+		waiter->next->prev = waiter->prev;
+	}
+
+	waiter->prev = NULL;
+	waiter->next = NULL;
+	waiter->linked = 0;
+
+	return 0;
+}
+
+int waitlist_empty(waitlist_t *list)
+{
+	return list->head == NULL;
+}
+
+void waitlist_defer(waitlist_t *pending, waiter_t waiter)
+{
+	waiter->prev = NULL;
+	waiter->next = NULL;
+	waiter->linked = 0;
+
+	if (pending->tail == NULL) {
+		pending->head = waiter;
+	} else {
+		pending->tail->next = waiter;
+	}
+	pending->tail = waiter;
+}
+
+void lock_waiter(waiter_t waiter)
+{
+	waiter->prev = NULL;
+	waiter->next = NULL;
+	waiter->linked = 0;
+	atomic_store(&waiter->wake, 0);
+	waiter->word = &waiter->wake;
+}
+
+void lock_waiter_shared(waiter_t waiter, atomic_int *word)
+{
+	waiter->prev = NULL;
+	waiter->next = NULL;
+	waiter->linked = 0;
+	waiter->word = word;
+}
+
+int lock_block(lock_t *lock, waiter_t waiter)
+{
+	/* Check for NULL lock or waiter */
+	if (lock == NULL || waiter == NULL) {
+		return -1;
+	}
+
+	lock_release(lock);
+
+	while (atomic_load(&waiter->wake) == 0) {
+		futex_wait(&waiter->wake, 0);
+	}
+
+	lock_acquire(lock);
+
+	return 0;
+}
+
+int lock_timedblock(lock_t *lock, waiter_t waiter,
+		    const struct timespec *abstime)
+{
+	int ret = 0;
+
+	/* Check for NULL lock or waiter */
+	if (lock == NULL || waiter == NULL) {
+		return -1;
+	}
+
+	lock_release(lock);
+
+	while (atomic_load(&waiter->wake) == 0) {
+		if (futex_timedwait(&waiter->wake, 0, abstime) == -1
+		    && errno == ETIMEDOUT) {
+			ret = -1;
+			break;
+		}
+	}
+
+	lock_acquire(lock);
+
+	return ret;
+}
+
+int lock_unblock(waiter_t waiter)
+{
+	atomic_int *word;
+
+	/* Check for NULL waiter */
+	if (waiter == NULL) {
+		return -1;
+	}
+
+	/* The waiter is gone as soon as the word is set */
+	word = waiter->word;
+	atomic_store(word, 1);
+	futex_wake(word, 1);
+
+	return 0;
+}
+
+void lock_unblock_list(waitlist_t *pending)
+{
+	waiter_t waiter, next;
+
+	for (waiter = pending->head; waiter != NULL; waiter = next) {
+		/* The waiter is gone as soon as it is unblocked */
+		next = waiter->next;
+		lock_unblock(waiter);
+	}
+
+	pending->head = NULL;
+	pending->tail = NULL;
+}
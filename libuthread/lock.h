@@ -0,0 +1,228 @@
+#ifndef _LOCK_H
+#define _LOCK_H
+
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * lock_t - Object lock type
+ *
+ * A lock provides mutual exclusion on a single object. Unlike the global
+ * critical section of thread.h, a lock is meant to be embedded in the object it
+ * protects, so that threads working on unrelated objects never contend with
+ * each other.
+ *
+ * Locks are not recursive.
+ */
+typedef struct lock {
+	atomic_int state;
+} lock_t;
+
+/*
+ * LOCK_INITIALIZER - Static initializer for an unlocked lock
+ */
+#define LOCK_INITIALIZER { 0 }
+
+/*
+ * lock_init - Initialize lock
+ * @lock: Lock to initialize
+ *
+ * Initialize @lock in the unlocked state.
+ */
+void lock_init(lock_t *lock);
+
+/*
+ * lock_acquire - Acquire lock
+ * @lock: Lock to acquire
+ *
+ * Acquire @lock, sleeping if it is currently held by another thread.
+ */
+void lock_acquire(lock_t *lock);
+
+/*
+ * lock_release - Release lock
+ * @lock: Lock to release
+ *
+ * Release @lock, which must be held by the calling thread, and wake up one of
+ * the threads waiting to acquire it.
+ */
+void lock_release(lock_t *lock);
+
+/*
+ * waiter_t - Waiter type
+ *
+ * A waiter represents a thread sleeping on an object. It is what an object
+ * keeps in its waiting list in order to wake up a specific thread later on.
+ *
+ * Waiters are meant to live on the stack of the waiting thread and are linked
+ * directly into the object's waiting list, so that blocking never allocates
+ * memory. Objects can embed a waiter as the first member of a larger structure
+ * in order to record extra information about the waiting thread.
+ */
+typedef struct waiter {
+	struct waiter *prev;
+	struct waiter *next;
+	int linked;
+	atomic_int wake;
+	atomic_int *word;
+} *waiter_t;
+
+/*
+ * waitlist_t - Waiting list type
+ *
+ * A waiting list is a FIFO of waiters. All operations are O(1). A waiting list
+ * is protected by the lock of the object it belongs to.
+ */
+typedef struct waitlist {
+	struct waiter *head;
+	struct waiter *tail;
+} waitlist_t;
+
+/*
+ * WAITLIST_INITIALIZER - Static initializer for an empty waiting list
+ */
+#define WAITLIST_INITIALIZER { NULL, NULL }
+
+/*
+ * waitlist_init - Initialize waiting list
+ * @list: Waiting list to initialize
+ */
+void waitlist_init(waitlist_t *list);
+
+/*
+ * waitlist_push - Add waiter to waiting list
+ * @list: Waiting list
+ * @waiter: Waiter to add at the end of @list
+ */
+void waitlist_push(waitlist_t *list, waiter_t waiter);
+
+/*
+ * waitlist_first - Oldest waiter of waiting list
+ * @list: Waiting list
+ *
+ * Return: Oldest waiter of @list, without removing it. NULL if @list is empty.
+ */
+waiter_t waitlist_first(waitlist_t *list);
+
+/*
+ * waitlist_pop - Remove oldest waiter from waiting list
+ * @list: Waiting list
+ *
+ * Return: Oldest waiter of @list. NULL if @list is empty.
+ */
+waiter_t waitlist_pop(waitlist_t *list);
+
+/*
+ * waitlist_remove - Remove waiter from waiting list
+ * @list: Waiting list
+ * @waiter: Waiter to remove
+ *
+ * Return: -1 if @waiter is not in a waiting list. 0 if @waiter was removed
+ * from @list.
+ */
+int waitlist_remove(waitlist_t *list, waiter_t waiter);
+
+/*
+ * waitlist_empty - Check if waiting list is empty
+ * @list: Waiting list
+ *
+ * Return: 1 if @list is empty, 0 otherwise.
+ */
+int waitlist_empty(waitlist_t *list);
+
+/*
+ * waitlist_defer - Add waiter to a list of threads to unblock later
+ * @pending: List of threads to unblock
+ * @waiter: Waiter already removed from its object's waiting list
+ *
+ * Waking threads up while holding the object's lock makes them contend on that
+ * lock as soon as they run. Instead, the threads to wake up can be collected
+ * in @pending while holding the lock, and all unblocked at once with
+ * lock_unblock_list() after releasing it.
+ *
+ * @pending is only a singly linked chain: @waiter is not considered to be in a
+ * waiting list anymore (waitlist_remove() on it fails).
+ */
+void waitlist_defer(waitlist_t *pending, waiter_t waiter);
+
+/*
+ * lock_waiter - Prepare waiter
+ * @waiter: Waiter of the calling thread
+ *
+ * Prepare the calling thread for blocking with @waiter, usually allocated on
+ * the thread's stack. @waiter must then be put in the object's waiting list
+ * before calling lock_block(), while still holding the object's lock.
+ */
+void lock_waiter(waiter_t waiter);
+
+/*
+ * lock_waiter_shared - Prepare waiter sharing a wake-up word
+ * @waiter: Waiter of the calling thread
+ * @word: Wake-up word, initialized to 0 by the calling thread
+ *
+ * Same as lock_waiter(), but unblocking @waiter sets @word to 1 and wakes up
+ * the thread sleeping on @word, instead of using @waiter's own word. This lets
+ * a thread be registered in several waiting lists at the same time, with one
+ * waiter in each, and be woken up by whichever comes first: the thread sleeps
+ * on @word itself with futex(2), rather than with lock_block().
+ */
+void lock_waiter_shared(waiter_t waiter, atomic_int *word);
+
+/*
+ * lock_block - Block thread on object lock
+ * @lock: Lock of the object to block on
+ * @waiter: Waiter prepared by lock_waiter()
+ *
+ * This is the per-object counterpart of thread_block(). The calling thread,
+ * which must hold @lock, releases @lock before going to sleep and re-acquires
+ * it upon wake-up. It can only be unblocked by another thread calling
+ * lock_unblock() on @waiter.
+ *
+ * Return: -1 if @lock or @waiter are NULL, 0 otherwise.
+ */
+int lock_block(lock_t *lock, waiter_t waiter);
+
+/*
+ * lock_timedblock - Block thread on object lock with a deadline
+ * @lock: Lock of the object to block on
+ * @waiter: Waiter prepared by lock_waiter()
+ * @abstime: Absolute deadline, measured against CLOCK_REALTIME
+ *
+ * Same as lock_block(), except that the calling thread also wakes up on its
+ * own once @abstime is reached. In that case, @lock is re-acquired as well,
+ * but @waiter is still registered in the object's waiting list unless another
+ * thread was unblocking it at the same time: the caller has to check and
+ * remove it. If @waiter was already removed, the caller must wait for the
+ * imminent wake-up with lock_block() before releasing @waiter.
+ *
+ * Return: -1 if @lock or @waiter are NULL, or if @abstime was reached. 0 if the
+ * thread was unblocked.
+ */
+int lock_timedblock(lock_t *lock, waiter_t waiter,
+		    const struct timespec *abstime);
+
+/*
+ * lock_unblock - Unblock thread
+ * @waiter: Waiter of the thread to unblock
+ *
+ * Unblock the thread owning @waiter. The caller must either hold the lock the
+ * thread is blocked on, or have removed @waiter from the object's waiting list
+ * while holding that lock.
+ *
+ * @waiter must not be accessed anymore after this call, since the unblocked
+ * thread may return and release it at any time.
+ *
+ * Return: -1 if @waiter is NULL, 0 otherwise.
+ */
+int lock_unblock(waiter_t waiter);
+
+/*
+ * lock_unblock_list - Unblock several threads
+ * @pending: List of threads to unblock, built with waitlist_defer()
+ *
+ * Unblock all the threads collected in @pending, and empty @pending. This is
+ * meant to be called after releasing the lock the threads are blocked on.
+ */
+void lock_unblock_list(waitlist_t *pending);
+
+#endif /* _LOCK_H */
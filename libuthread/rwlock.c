@@ -0,0 +1,269 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "lock.h"
+#include "rwlock.h"
+
+/* Size of a cache line, so that reader counters never share one */
+#define RWLOCK_CACHELINE	64
+
+/* Number of reader counters per lock */
+#ifndef RWLOCK_SLOTS
+#define RWLOCK_SLOTS	16
+#endif
+
+/*
+ * Reader indicator: number of readers among the threads mapped to this slot.
+ * The padding keeps each counter on its own cache line.
+ */
+struct rwlock_slot {
+	_Alignas(RWLOCK_CACHELINE) atomic_int readers;
+};
+
+/*
+ * A writer sleeping in the writers' waiting list. @granted is set when the
+ * lock is handed over to it by the previous writer (RWLOCK_PREFER_WRITER).
+ */
+struct rwlock_wait {
+	struct waiter waiter;
+	int granted;
+};
+
+/*
+ * Readers are counted in @slots, each thread always using the same slot, so
+ * that readers running on different CPUs do not bounce a single counter
+ * between their caches. @writer is set while a writer holds the lock or waits
+ * for the readers to leave.
+ *
+ * A reader first increments its counter and then checks @writer, while a
+ * writer first sets @writer and then sums the counters. Because both use
+ * sequentially consistent atomics, either the reader sees the writer and backs
+ * off, or the writer sees the reader and waits for it.
+ *
+ * @lock protects the waiting lists and @drainer, the writer waiting for the
+ * readers to leave. @writer is only ever set with @lock held, so a reader
+ * holding @lock and seeing no writer cannot be overtaken by one.
+ */
+struct rwlock {
+	lock_t lock;
+	waitlist_t readers_wait;
+	waitlist_t writers_wait;
+	waiter_t drainer;
+	atomic_int writer;
+	int flags;
+	struct rwlock_slot slots[RWLOCK_SLOTS];
+};
+
+/* Slot of the calling thread, plus one (0 until first used) */
+static __thread unsigned int rwlock_slot;
+static atomic_uint rwlock_next_slot;
+
+/* Get the reader counter of the calling thread in @rwlock */
+static struct rwlock_slot *rwlock_my_slot(rwlock_t rwlock)
+{
+	if (rwlock_slot == 0) {
+		rwlock_slot = atomic_fetch_add_explicit(&rwlock_next_slot, 1,
+							memory_order_relaxed)
+			% RWLOCK_SLOTS + 1;
+	}
+
+	return &rwlock->slots[rwlock_slot - 1];
+}
+
+/* Total number of readers holding, or trying to get, @rwlock */
+static int rwlock_readers(rwlock_t rwlock)
+{
+	int i, readers = 0;
+
+	for (i = 0; i < RWLOCK_SLOTS; i++) {
+		readers += atomic_load(&rwlock->slots[i].readers);
+	}
+
+	return readers;
+}
+
+/*
+ * Unblock the writer waiting for the readers to leave, if they all did. Must
+ * be called with the lock held.
+ */
+static void rwlock_wake_drainer(rwlock_t rwlock, waitlist_t *pending)
+{
+	if (rwlock->drainer != NULL && rwlock_readers(rwlock) == 0) {
+		waitlist_defer(pending, rwlock->drainer);
+		rwlock->drainer = NULL;
+	}
+}
+
+/***** API Definitions *****/
+rwlock_t rwlock_create(int flags)
+{
+	rwlock_t new_rwlock;
+	int i;
+
+	new_rwlock = (rwlock_t) aligned_alloc(RWLOCK_CACHELINE,
+					       sizeof(struct rwlock));
+	if (new_rwlock == NULL) {
+		return NULL;
+	}
+
+	lock_init(&new_rwlock->lock);
+	waitlist_init(&new_rwlock->readers_wait);
+	waitlist_init(&new_rwlock->writers_wait);
+	new_rwlock->drainer = NULL;
+	atomic_init(&new_rwlock->writer, 0);
+	new_rwlock->flags = flags;
+	for (i = 0; i < RWLOCK_SLOTS; i++) {
+		atomic_init(&new_rwlock->slots[i].readers, 0);
+	}
+
+	return new_rwlock;
+}
+
+int rwlock_destroy(rwlock_t rwlock)
+{
+	/* Check for NULL rwlock or lock being held */
+	if (rwlock == NULL) {
+		return -1;
+	} else if (atomic_load(&rwlock->writer) || rwlock_readers(rwlock)) {
+		return -1;
+	}
+
+	free(rwlock);
+
+	return 0;
+}
+
+int rwlock_rdlock(rwlock_t rwlock)
+{
+	waitlist_t pending = WAITLIST_INITIALIZER;
+	struct waiter waiter;
+	struct rwlock_slot *slot;
+
+	/* Check for NULL rwlock */
+	if (rwlock == NULL) {
+		return -1;
+	}
+
+	/* Fast path: no writer around */
+	slot = rwlock_my_slot(rwlock);
+	atomic_fetch_add(&slot->readers, 1);
+	if (atomic_load(&rwlock->writer) == 0) {
+		return 0;
+	}
+
+	/*
+	 * Slow path: back off, and let a draining writer go if we were last.
+	 * The writer has to be unblocked right away, since we are about to
+	 * sleep until it is done.
+	 */
+	lock_acquire(&rwlock->lock);
+	atomic_fetch_sub(&slot->readers, 1);
+	rwlock_wake_drainer(rwlock, &pending);
+	lock_unblock_list(&pending);
+
+	while (atomic_load(&rwlock->writer)) {
+		lock_waiter(&waiter);
+		waitlist_push(&rwlock->readers_wait, &waiter);
+		lock_block(&rwlock->lock, &waiter);
+	}
+
+	/* No writer can come in while we hold the lock */
+	atomic_fetch_add(&slot->readers, 1);
+
+	lock_release(&rwlock->lock);
+
+	return 0;
+}
+
+int rwlock_rdunlock(rwlock_t rwlock)
+{
+	waitlist_t pending = WAITLIST_INITIALIZER;
+
+	/* Check for NULL rwlock */
+	if (rwlock == NULL) {
+		return -1;
+	}
+
+	atomic_fetch_sub(&rwlock_my_slot(rwlock)->readers, 1);
+
+	/* Fast path: no writer waiting for us */
+	if (atomic_load(&rwlock->writer) == 0) {
+		return 0;
+	}
+
+	lock_acquire(&rwlock->lock);
+	rwlock_wake_drainer(rwlock, &pending);
+	lock_release(&rwlock->lock);
+	lock_unblock_list(&pending);
+
+	return 0;
+}
+
+int rwlock_wrlock(rwlock_t rwlock)
+{
+	struct rwlock_wait wait;
+
+	/* Check for NULL rwlock */
+	if (rwlock == NULL) {
+		return -1;
+	}
+
+	lock_acquire(&rwlock->lock);
+
+	/* Wait for the current writer, unless it hands the lock over to us */
+	wait.granted = 0;
+	while (!wait.granted && atomic_load(&rwlock->writer)) {
+		lock_waiter(&wait.waiter);
+		waitlist_push(&rwlock->writers_wait, &wait.waiter);
+		lock_block(&rwlock->lock, &wait.waiter);
+	}
+
+	/* Close the lock to new readers, and wait for the current ones */
+	atomic_store(&rwlock->writer, 1);
+	while (rwlock_readers(rwlock) != 0) {
+		lock_waiter(&wait.waiter);
+		rwlock->drainer = &wait.waiter;
+		lock_block(&rwlock->lock, &wait.waiter);
+	}
+
+	lock_release(&rwlock->lock);
+
+	return 0;
+}
+
+int rwlock_wrunlock(rwlock_t rwlock)
+{
+	waitlist_t pending = WAITLIST_INITIALIZER;
+	struct rwlock_wait *wait;
+	waiter_t waiter;
+
+	/* Check for NULL rwlock */
+	if (rwlock == NULL) {
+		return -1;
+	}
+
+	lock_acquire(&rwlock->lock);
+
+	if ((rwlock->flags & RWLOCK_PREFER_WRITER)
+	    && !waitlist_empty(&rwlock->writers_wait)) {
+		/* Keep the lock closed to readers, and give it to next writer */
+		wait = (struct rwlock_wait*)waitlist_pop(&rwlock->writers_wait);
+		wait->granted = 1;
+		waitlist_defer(&pending, &wait->waiter);
+	} else {
+		/* Let all waiting readers in, along with the next writer */
+		atomic_store(&rwlock->writer, 0);
+		while ((waiter = waitlist_pop(&rwlock->readers_wait))) {
+			waitlist_defer(&pending, waiter);
+		}
+		if ((waiter = waitlist_pop(&rwlock->writers_wait))) {
+			waitlist_defer(&pending, waiter);
+		}
+	}
+
+	lock_release(&rwlock->lock);
+	lock_unblock_list(&pending);
+
+	return 0;
+}
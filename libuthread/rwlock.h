@@ -0,0 +1,90 @@
+#ifndef _RWLOCK_H
+#define _RWLOCK_H
+
+/*
+ * rwlock_t - Reader-writer lock type
+ *
+ * A reader-writer lock protects read-mostly data: any number of readers can
+ * hold it at the same time, while a writer holds it alone. Readers which do
+ * not run into a writer only touch a counter of their own, so that they do
+ * not contend with each other.
+ *
+ * A writer arriving closes the lock to new readers and waits for the current
+ * readers to leave, so that writers are never starved by readers.
+ */
+typedef struct rwlock *rwlock_t;
+
+/*
+ * Reader-writer lock flags
+ *
+ * RWLOCK_PREFER_WRITER: When a writer releases the lock while other writers
+ * are waiting, hand the lock directly to the next writer instead of letting
+ * the waiting readers in first. This minimizes the latency of writers, at the
+ * cost of starving readers if writers keep coming.
+ */
+#define RWLOCK_PREFER_WRITER	0x1
+
+/*
+ * rwlock_create - Create reader-writer lock
+ * @flags: Reader-writer lock flags (e.g. RWLOCK_PREFER_WRITER)
+ *
+ * Allocate and initialize an unlocked reader-writer lock.
+ *
+ * Return: Pointer to initialized lock. NULL in case of failure when allocating
+ * the new lock.
+ */
+rwlock_t rwlock_create(int flags);
+
+/*
+ * rwlock_destroy - Deallocate a reader-writer lock
+ * @rwlock: Lock to deallocate
+ *
+ * Return: -1 if @rwlock is NULL or if it is currently held. 0 if @rwlock was
+ * successfully destroyed.
+ */
+int rwlock_destroy(rwlock_t rwlock);
+
+/*
+ * rwlock_rdlock - Acquire reader-writer lock for reading
+ * @rwlock: Lock to acquire
+ *
+ * Acquire @rwlock in shared mode, blocking while a writer holds it or is
+ * waiting for it.
+ *
+ * Return: -1 if @rwlock is NULL. 0 if @rwlock was successfully acquired.
+ */
+int rwlock_rdlock(rwlock_t rwlock);
+
+/*
+ * rwlock_rdunlock - Release reader-writer lock held for reading
+ * @rwlock: Lock to release
+ *
+ * Release @rwlock, which must have been acquired for reading by the calling
+ * thread.
+ *
+ * Return: -1 if @rwlock is NULL. 0 if @rwlock was successfully released.
+ */
+int rwlock_rdunlock(rwlock_t rwlock);
+
+/*
+ * rwlock_wrlock - Acquire reader-writer lock for writing
+ * @rwlock: Lock to acquire
+ *
+ * Acquire @rwlock in exclusive mode, blocking while other threads hold it.
+ *
+ * Return: -1 if @rwlock is NULL. 0 if @rwlock was successfully acquired.
+ */
+int rwlock_wrlock(rwlock_t rwlock);
+
+/*
+ * rwlock_wrunlock - Release reader-writer lock held for writing
+ * @rwlock: Lock to release
+ *
+ * Release @rwlock, which must have been acquired for writing by the calling
+ * thread, and wake up the threads waiting for it.
+ *
+ * Return: -1 if @rwlock is NULL. 0 if @rwlock was successfully released.
+ */
+int rwlock_wrunlock(rwlock_t rwlock);
+
+#endif /* _RWLOCK_H */
@@ -1,107 +1,1307 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <poll.h>
 #include <pthread.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
-#include "queue.h"
+#include "futex.h"
+#include "lock.h"
 #include "sem.h"
-#include "thread.h"
 
-struct semaphore {
-	queue_t wait_queue;
-	size_t count;
+/*
+ * The count of a semaphore (see struct semaphore in sem.h) is updated with
+ * atomic operations so that an uncontended
+ * sem_down()/sem_up() never has to take the semaphore's lock. The lock, which
+ * protects @wait_list, is only taken when a thread has to sleep (sem_down()
+ * with a count of 0) or when there may be a sleeping thread to wake up
+ * (sem_up() with a non-zero number of waiters).
+ *
+ * A thread going to sleep first increments @waiters and then checks @count
+ * again, while a thread releasing the semaphore first increments @count and
+ * then checks @waiters. Because both use sequentially consistent atomics, at
+ * least one of the two always sees the other's update, so a wake-up can never
+ * be lost.
+ *
+ * With the SEM_FUTEX engine, @count itself is the futex word that waiting
+ * threads sleep on. @lock and @wait_list are only used by threads waiting in
+ * sem_down_any(), which are counted in @any_waiters.
+ *
+ * With SEM_SHARDED, available resources are also parked in @shards, one counter
+ * per group of threads, each on its own cache line. A thread releasing
+ * resources adds them to its shard as long as nobody waits, and taking them
+ * back from there never touches the cache lines other threads use. @count is
+ * then only the overflow, where resources go once somebody waits: a thread
+ * about to sleep first registers in @waiters and then drains every shard into
+ * @count, while a thread parking resources first adds them to its shard and
+ * then checks @waiters, and drains them itself if it sees a waiter. Like for
+ * @count, one of the two always sees the other.
+ *
+ * SEM_SHARED semaphores use the futex engine with process-shared futexes, so
+ * that the whole state is the structure itself: every field but @lock,
+ * @wait_list and @stats, which are never used, is meaningful in any process
+ * mapping it. The fast path is the same as for private semaphores.
+ *
+ * With SEM_EVENTFD, the count is kept by the kernel in the eventfd counter @fd
+ * instead, and @waiters only counts the threads blocked in poll(2) on @fd.
+ *
+ * Before sleeping, sem_down() spins for a while in case a resource is released
+ * shortly. @spin is a running average of how long spinning took when it was
+ * successful, and drops towards 0 when spinning fails, so that semaphores
+ * which are held for a long time quickly stop wasting CPU time.
+ */
+
+/*
+ * Contention statistics, only collected when the library is built with
+ * `make STATS=1`. Otherwise, these compile down to nothing.
+ *
+ * The counters are allocated on first use rather than embedded, so that the
+ * layout of struct semaphore, which callers may embed, does not depend on how
+ * the library was built.
+ */
+#ifdef SEM_STATS
+struct sem_counters {
+	atomic_ullong downs;
+	atomic_ullong ups;
+	atomic_ullong blocked;
+	atomic_ullong wait_total_ns;
+	atomic_ullong wait_max_ns;
+	atomic_ullong wait_hist[SEM_STATS_BUCKETS];
+	atomic_int max_waiters;
+};
+
+/* Get the counters of @sem, allocating them if needed. NULL if out of memory */
+static struct sem_counters *sem_counters(sem_t sem)
+{
+	struct sem_counters *counters, *new_counters;
+
+	/* Heap memory is private to each process */
+	if (sem->flags & SEM_SHARED) {
+		return NULL;
+	}
+
+	counters = atomic_load_explicit(&sem->stats, memory_order_acquire);
+	if (counters != NULL) {
+		return counters;
+	}
+
+	new_counters = calloc(1, sizeof(*new_counters));
+	if (new_counters == NULL) {
+		return NULL;
+	}
+
+	/* Another thread may have beaten us to it */
+	if (!atomic_compare_exchange_strong(&sem->stats, &counters,
+					    new_counters)) {
+		free(new_counters);
+		return counters;
+	}
+
+	return new_counters;
+}
+
+#define sem_stat_inc(sem, field) do {					\
+	struct sem_counters *__c = sem_counters(sem);			\
+	if (__c != NULL) {						\
+		atomic_fetch_add_explicit(&__c->field, 1,		\
+					  memory_order_relaxed);	\
+	}								\
+} while (0)
+#else
+#define sem_stat_inc(sem, field) do { } while (0)
+#endif
+
+/* Spinning bounds: always probe a little, never spin more than SEM_SPIN_MAX */
+#define SEM_SPIN_MIN	16
+#ifndef SEM_SPIN_MAX
+#define SEM_SPIN_MAX	4096
+#endif
+
+/* Tell the CPU we are busy-waiting */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/* Size of a cache line, so that shards never share one */
+#define SEM_CACHELINE	64
+
+/* Maximum number of shards of a SEM_SHARDED semaphore */
+#define SEM_SHARDS_MAX	64
+
+/* Resources parked by the threads mapped to this shard */
+struct sem_shard {
+	_Alignas(SEM_CACHELINE) atomic_int count;
+};
+
+/* Shard hint of the calling thread, plus one (0 until first used) */
+static __thread unsigned int sem_shard_hint;
+static atomic_uint sem_next_shard_hint;
+
+/*
+ * A thread waiting in sem_down_any(), registered in the wait_list of several
+ * semaphores. @winner is the index of the semaphore which gave it a resource,
+ * -1 until one did, and @wake is the word it sleeps on.
+ */
+struct sem_any {
+	atomic_int wake;
+	atomic_int winner;
 };
 
+/*
+ * A thread sleeping in the wait_list. Lives on the stack of the sleeping
+ * thread, and records how many resources it is waiting for. For a thread in
+ * sem_down_any(), @any is shared by all its registrations and @index is the
+ * index of this semaphore in the caller's array.
+ */
+struct sem_wait {
+	struct waiter waiter;
+	int n;
+	int granted;
+	struct sem_any *any;
+	int index;
+};
+
+/* Register as a waiter, keeping track of the longest wait_list */
+static void sem_waiter_enter(sem_t sem)
+{
+	int waiters = atomic_fetch_add(&sem->waiters, 1) + 1;
+
+#ifdef SEM_STATS
+	struct sem_counters *counters = sem_counters(sem);
+	int max;
+
+	if (counters == NULL) {
+		return;
+	}
+
+	max = atomic_load_explicit(&counters->max_waiters, memory_order_relaxed);
+	while (waiters > max
+	       && !atomic_compare_exchange_weak(&counters->max_waiters, &max,
+						waiters)) {
+	}
+#else
+	(void)waiters;
+#endif
+}
+
+#ifdef SEM_STATS
+static unsigned long long sem_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Account for a thread that waited @ns nanoseconds in sem_down() */
+static void sem_stat_wait(sem_t sem, unsigned long long ns)
+{
+	struct sem_counters *counters = sem_counters(sem);
+	unsigned long long max, us;
+	int bucket;
+
+	if (counters == NULL) {
+		return;
+	}
+
+	atomic_fetch_add_explicit(&counters->wait_total_ns, ns,
+				  memory_order_relaxed);
+
+	max = atomic_load_explicit(&counters->wait_max_ns, memory_order_relaxed);
+	while (ns > max
+	       && !atomic_compare_exchange_weak(&counters->wait_max_ns, &max,
+						ns)) {
+	}
+
+	/* One bucket per power of ten, starting at 1us */
+	for (bucket = 0, us = ns / 1000; us > 0 && bucket < SEM_STATS_BUCKETS - 1;
+	     us /= 10) {
+		bucket++;
+	}
+	sem_stat_inc(sem, wait_hist[bucket]);
+}
+#endif
+
+/* Take @n resources at once from @counter, return 1 on success */
+static int sem_counter_take(atomic_int *counter, int n)
+{
+	int count = atomic_load(counter);
+
+	while (count >= n) {
+		if (atomic_compare_exchange_weak(counter, &count, count - n)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Take up to @n resources from @counter, return how many were taken */
+static int sem_counter_takeupto(atomic_int *counter, int n)
+{
+	int count = atomic_load(counter);
+	int taken;
+
+	do {
+		if (count <= 0 || n == 0) {
+			return 0;
+		}
+		taken = (n < count) ? n : count;
+	} while (!atomic_compare_exchange_weak(counter, &count, count - taken));
+
+	return taken;
+}
+
+/* Take @n resources at once without blocking, return 1 on success */
+static int sem_trytake(sem_t sem, int n)
+{
+	return sem_counter_take(&sem->count, n);
+}
+
+/***** Shards *****/
+/* Index of the shard of the calling thread */
+static int sem_shard_index(sem_t sem)
+{
+	if (sem_shard_hint == 0) {
+		sem_shard_hint = atomic_fetch_add_explicit(
+			&sem_next_shard_hint, 1, memory_order_relaxed) + 1;
+	}
+
+	return (sem_shard_hint - 1) % sem->nshards;
+}
+
+/*
+ * Take @n resources at once without blocking, from the shard of the calling
+ * thread first, then from the overflow count, and finally from the other
+ * shards. Return 1 on success.
+ */
+static int sem_fasttake(sem_t sem, int n)
+{
+	int local, i;
+
+	if (sem->shards == NULL) {
+		return sem_trytake(sem, n);
+	}
+
+	local = sem_shard_index(sem);
+	if (sem_counter_take(&sem->shards[local].count, n)
+	    || sem_trytake(sem, n)) {
+		return 1;
+	}
+
+	for (i = 1; i < sem->nshards; i++) {
+		if (sem_counter_take(&sem->shards[(local + i) % sem->nshards].count,
+				     n)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Move the resources parked in the shards to the overflow count, so that
+ * waiting threads see them. Return how many were moved.
+ */
+static int sem_shard_drain(sem_t sem)
+{
+	int i, moved = 0;
+
+	if (sem->shards == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < sem->nshards; i++) {
+		if (atomic_load(&sem->shards[i].count) != 0) {
+			moved += atomic_exchange(&sem->shards[i].count, 0);
+		}
+	}
+
+	if (moved > 0) {
+		atomic_fetch_add(&sem->count, moved);
+	}
+
+	return moved;
+}
+
+/*
+ * Park @n resources in the shard of the calling thread if nobody waits.
+ * Return how many resources were added to the overflow count instead, for
+ * waiting threads to be woken up.
+ */
+static int sem_shard_give(sem_t sem, int n)
+{
+	if (atomic_load(&sem->waiters) == 0) {
+		atomic_fetch_add(&sem->shards[sem_shard_index(sem)].count, n);
+		if (atomic_load(&sem->waiters) == 0) {
+			return 0;
+		}
+
+		/* Somebody started waiting meanwhile and may have missed them */
+		return sem_shard_drain(sem);
+	}
+
+	atomic_fetch_add(&sem->count, n);
+
+	return n;
+}
+
+/*
+ * Whether sem_down() should spin on @sem before going to sleep. Spinning is
+ * pointless when only one thread can run at a time, and would let a spinning
+ * thread overtake the waiting list under SEM_HANDOFF.
+ */
+static int sem_canspin(sem_t sem)
+{
+	static atomic_int nprocs;
+	int n;
+
+	if (SEM_SPIN_MAX == 0 || (sem->flags & (SEM_NOSPIN | SEM_HANDOFF))) {
+		return 0;
+	}
+
+	n = atomic_load_explicit(&nprocs, memory_order_relaxed);
+	if (n == 0) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		atomic_store_explicit(&nprocs, n, memory_order_relaxed);
+	}
+
+	return n > 1;
+}
+
+/*
+ * Spin for @n resources before going to sleep, return 1 on success. The
+ * spinning budget is adapted from the previous attempts on this semaphore.
+ */
+static int sem_spintake(sem_t sem, int n)
+{
+	int spin, limit, i;
+
+	spin = atomic_load_explicit(&sem->spin, memory_order_relaxed);
+	limit = spin * 2 + SEM_SPIN_MIN;
+	if (limit > SEM_SPIN_MAX) {
+		limit = SEM_SPIN_MAX;
+	}
+
+	for (i = 0; i < limit; i++) {
+		if (sem_fasttake(sem, n)) {
+			spin += (i - spin) / 8;
+			atomic_store_explicit(&sem->spin, spin, memory_order_relaxed);
+			return 1;
+		}
+		cpu_relax();
+	}
+
+	spin -= spin / 8 + 1;
+	if (spin < 0) {
+		spin = 0;
+	}
+	atomic_store_explicit(&sem->spin, spin, memory_order_relaxed);
+
+	return 0;
+}
+
+/***** Queue engine *****/
+/*
+ * Make @wait's semaphore the one that sem_down_any() returns. Return 1 on
+ * success, 0 if the thread already got a resource from another semaphore.
+ */
+static int sem_any_claim(struct sem_wait *wait)
+{
+	int winner = -1;
+
+	return atomic_compare_exchange_strong(&wait->any->winner, &winner,
+					      wait->index);
+}
+
+/*
+ * Select the oldest waiting threads for wake-up, for as long as the available
+ * resources can satisfy them. Must be called with the semaphore's lock held.
+ * The selected threads are collected in @pending, and should be unblocked with
+ * lock_unblock_list() once the lock is released, so that they do not
+ * immediately contend on it.
+ *
+ * With SEM_HANDOFF, the resources are taken on behalf of the woken threads,
+ * which own them as soon as they are unblocked. Otherwise, woken threads have
+ * to take the resources themselves and may find that other threads were
+ * faster.
+ */
+static void sem_queue_wake_locked(sem_t sem, waitlist_t *pending)
+{
+	struct sem_wait *wait;
+	int count;
+
+	count = atomic_load(&sem->count);
+
+	while ((wait = (struct sem_wait*)waitlist_first(&sem->wait_list))) {
+		if (wait->any != NULL) {
+			/*
+			 * Always hand the resource over, since the thread
+			 * cannot come back to this semaphore by itself. It may
+			 * have been given one by another semaphore already.
+			 */
+			if (!sem_trytake(sem, 1)) {
+				break;
+			}
+			count--;
+
+			waitlist_pop(&sem->wait_list);
+			if (!sem_any_claim(wait)) {
+				atomic_fetch_add(&sem->count, 1);
+				count++;
+				continue;
+			}
+			waitlist_defer(pending, &wait->waiter);
+			continue;
+		}
+
+		if (sem->flags & SEM_HANDOFF) {
+			if (!sem_trytake(sem, wait->n)) {
+				break;
+			}
+			wait->granted = 1;
+		} else if (wait->n > count) {
+			break;
+		} else {
+			count -= wait->n;
+		}
+
+		waitlist_pop(&sem->wait_list);
+		waitlist_defer(pending, &wait->waiter);
+	}
+}
+
+static int sem_queue_down(sem_t sem, int n, const struct timespec *abstime)
+{
+	waitlist_t pending = WAITLIST_INITIALIZER;
+	struct sem_wait wait;
+	int ret = 0;
+
+	lock_acquire(&sem->lock);
+
+	/*
+	 * Register as a waiter before checking the count again, a concurrent
+	 * sem_up() either sees us waiting or we see its resources
+	 */
+	sem_waiter_enter(sem);
+	if (sem_shard_drain(sem) > 0) {
+		sem_queue_wake_locked(sem, &pending);
+	}
+
+	wait.n = n;
+	wait.granted = 0;
+	wait.any = NULL;
+	while (!wait.granted) {
+		if (!(sem->flags & SEM_HANDOFF)) {
+			if (sem_trytake(sem, n)) {
+				break;
+			}
+
+			/*
+			 * Woken up, but other threads took the resources
+			 * first: let the next waiters use what is left before
+			 * going back to sleep. They are only woken up once the
+			 * lock is released, and the count must then be checked
+			 * again.
+			 */
+			sem_queue_wake_locked(sem, &pending);
+			if (!waitlist_empty(&pending)) {
+				lock_release(&sem->lock);
+				lock_unblock_list(&pending);
+				lock_acquire(&sem->lock);
+				continue;
+			}
+		} else if (waitlist_empty(&sem->wait_list) && sem_trytake(sem, n)) {
+			/* Only take resources directly when nobody is first */
+			break;
+		}
+
+		lock_waiter(&wait.waiter);
+		waitlist_push(&sem->wait_list, &wait.waiter);
+
+		if (abstime == NULL) {
+			lock_block(&sem->lock, &wait.waiter);
+		} else if (lock_timedblock(&sem->lock, &wait.waiter, abstime) == 0) {
+			continue;
+		} else if (waitlist_remove(&sem->wait_list, &wait.waiter) == 0) {
+			/*
+			 * Timed out while still in the wait_list. We may
+			 * have been holding back the threads behind us.
+			 */
+			sem_queue_wake_locked(sem, &pending);
+			ret = -1;
+			break;
+		} else {
+			/*
+			 * Timed out, but already selected for wake-up: our
+			 * waiter must stay around until it is unblocked
+			 */
+			lock_block(&sem->lock, &wait.waiter);
+		}
+	}
+
+	atomic_fetch_sub(&sem->waiters, 1);
+
+	lock_release(&sem->lock);
+	lock_unblock_list(&pending);
+
+	return ret;
+}
+
+static void sem_queue_wake(sem_t sem)
+{
+	waitlist_t pending = WAITLIST_INITIALIZER;
+
+	lock_acquire(&sem->lock);
+	sem_queue_wake_locked(sem, &pending);
+	lock_release(&sem->lock);
+
+	/* Wake threads up only once they can get the lock */
+	lock_unblock_list(&pending);
+}
+
+/***** Futex engine *****/
+static int sem_futex_timedwait(sem_t sem, int count,
+			       const struct timespec *abstime)
+{
+	if (sem->flags & SEM_SHARED) {
+		return futex_timedwait_shared(&sem->count, count, abstime);
+	}
+
+	return futex_timedwait(&sem->count, count, abstime);
+}
+
+static void sem_futex_wake(sem_t sem, int n)
+{
+	/*
+	 * Waking up n threads is not enough if some of them wait for several
+	 * resources: wake up everybody and let them sort it out
+	 */
+	if (atomic_load(&sem->bulk_waiters) > 0) {
+		n = INT_MAX;
+	}
+
+	if (sem->flags & SEM_SHARED) {
+		futex_wake_shared(&sem->count, n);
+	} else {
+		futex_wake(&sem->count, n);
+	}
+}
+
+/* Wake up threads waiting for the @n resources just added to the count */
+static void sem_wake(sem_t sem, int n)
+{
+	/* Fast path: nobody to wake up */
+	if (atomic_load(&sem->waiters) == 0) {
+		return;
+	}
+
+	if (!(sem->flags & SEM_FUTEX)) {
+		sem_queue_wake(sem);
+		return;
+	}
+
+	sem_futex_wake(sem, n);
+
+	/* Threads in sem_down_any() are always in the wait_list */
+	if (atomic_load(&sem->any_waiters) != 0) {
+		sem_queue_wake(sem);
+	}
+}
+
+static int sem_futex_down(sem_t sem, int n, const struct timespec *abstime)
+{
+	int count, moved;
+	int ret = 0;
+
+	sem_waiter_enter(sem);
+
+	/* Other threads may be sleeping already, let them share */
+	moved = sem_shard_drain(sem);
+	if (moved > 0) {
+		sem_wake(sem, moved);
+	}
+
+	if (n > 1) {
+		atomic_fetch_add(&sem->bulk_waiters, 1);
+	}
+
+	/* Sleep on the count for as long as it stays too low */
+	while (!sem_trytake(sem, n)) {
+		count = atomic_load(&sem->count);
+		if (count < n
+		    && sem_futex_timedwait(sem, count, abstime) == -1
+		    && errno == ETIMEDOUT) {
+			/* Last chance, in case we were woken up just in time */
+			if (!sem_trytake(sem, n)) {
+				ret = -1;
+			}
+			break;
+		}
+	}
+
+	if (n > 1) {
+		atomic_fetch_sub(&sem->bulk_waiters, 1);
+	}
+	atomic_fetch_sub(&sem->waiters, 1);
+
+	return ret;
+}
+
+/***** Eventfd engine *****/
+/* Take one resource without blocking, return 1 on success */
+static int sem_eventfd_trytake(sem_t sem)
+{
+	uint64_t value;
+	ssize_t ret;
+
+	do {
+		ret = read(sem->fd, &value, sizeof(value));
+	} while (ret == -1 && errno == EINTR);
+
+	return ret == sizeof(value);
+}
+
+static int sem_eventfd_down(sem_t sem, const struct timespec *abstime)
+{
+	struct pollfd pfd = { .fd = sem->fd, .events = POLLIN };
+	struct timespec now;
+	int timeout = -1;
+	int ret = 0;
+
+	sem_waiter_enter(sem);
+
+	/* Wait for the counter to be non-zero, and race for it */
+	while (!sem_eventfd_trytake(sem)) {
+		if (abstime != NULL) {
+			long long ms;
+
+			clock_gettime(CLOCK_REALTIME, &now);
+			ms = (abstime->tv_sec - now.tv_sec) * 1000LL
+				+ (abstime->tv_nsec - now.tv_nsec + 999999) / 1000000;
+			if (ms <= 0) {
+				ret = -1;
+				break;
+			}
+			timeout = (ms > INT_MAX) ? INT_MAX : ms;
+		}
+		poll(&pfd, 1, timeout);
+	}
+
+	atomic_fetch_sub(&sem->waiters, 1);
+
+	return ret;
+}
+
+static void sem_eventfd_give(sem_t sem, int n)
+{
+	uint64_t value = n;
+	ssize_t ret;
+
+	do {
+		ret = write(sem->fd, &value, sizeof(value));
+	} while (ret == -1 && errno == EINTR);
+}
+
+/* Current value of the eventfd counter, which the kernel reports in fdinfo */
+static int sem_eventfd_value(sem_t sem)
+{
+	unsigned long long value = 0;
+	char path[64], line[128];
+	FILE *fdinfo;
+
+	snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", sem->fd);
+	fdinfo = fopen(path, "r");
+	if (fdinfo == NULL) {
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fdinfo)) {
+		if (sscanf(line, "eventfd-count: %llx", &value) == 1) {
+			break;
+		}
+	}
+	fclose(fdinfo);
+
+	return (value > INT_MAX) ? INT_MAX : (int)value;
+}
+
+/*
+ * Check if the calling thread can take resources directly. With SEM_HANDOFF,
+ * it must not overtake the threads already waiting.
+ */
+static int sem_canbarge(sem_t sem)
+{
+	return !(sem->flags & SEM_HANDOFF) || atomic_load(&sem->waiters) == 0;
+}
+
+/*
+ * Take @n resources, blocking until they are all available or until @abstime
+ * is reached (if not NULL). Return -1 on timeout, 0 otherwise.
+ */
+static int sem_take(sem_t sem, int n, const struct timespec *abstime)
+{
+	int ret;
+#ifdef SEM_STATS
+	unsigned long long start;
+#endif
+
+	/* The count is not in memory */
+	if (sem->flags & SEM_EVENTFD) {
+		if (sem_eventfd_trytake(sem)) {
+			sem_stat_inc(sem, downs);
+			return 0;
+		}
+
+		sem_stat_inc(sem, blocked);
+		ret = sem_eventfd_down(sem, abstime);
+		if (ret == 0) {
+			sem_stat_inc(sem, downs);
+		}
+		return ret;
+	}
+
+	/* Fast path: take available resources */
+	if (sem_canbarge(sem) && sem_fasttake(sem, n)) {
+		sem_stat_inc(sem, downs);
+		return 0;
+	}
+
+	/* Spin for a little while before going to sleep */
+	if (sem_canspin(sem) && sem_spintake(sem, n)) {
+		sem_stat_inc(sem, downs);
+		return 0;
+	}
+
+	sem_stat_inc(sem, blocked);
+#ifdef SEM_STATS
+	start = sem_now_ns();
+#endif
+
+	if (sem->flags & SEM_FUTEX) {
+		ret = sem_futex_down(sem, n, abstime);
+	} else {
+		ret = sem_queue_down(sem, n, abstime);
+	}
+
+#ifdef SEM_STATS
+	sem_stat_wait(sem, sem_now_ns() - start);
+	if (ret == 0) {
+		sem_stat_inc(sem, downs);
+	}
+#endif
+
+	return ret;
+}
+
+/* Give @n resources back, waking up waiting threads accordingly */
+static void sem_give(sem_t sem, int n)
+{
+	sem_stat_inc(sem, ups);
+
+	/* The kernel wakes up the pollers */
+	if (sem->flags & SEM_EVENTFD) {
+		sem_eventfd_give(sem, n);
+		return;
+	}
+
+	if (sem->shards == NULL) {
+		atomic_fetch_add(&sem->count, n);
+	} else if ((n = sem_shard_give(sem, n)) == 0) {
+		/* Parked in our shard, nobody to wake up */
+		return;
+	}
+
+	sem_wake(sem, n);
+}
+
+/* Number of semaphores sem_down_any() can wait on without allocating memory */
+#define SEM_ANY_STACK	8
+
+/***** API Definitions *****/
 sem_t sem_create(size_t count)
+{
+	return sem_create_flags(count, SEM_DEFAULT_FLAGS);
+}
+
+sem_t sem_create_flags(size_t count, int flags)
 {
 	sem_t new_sem;
 
 	new_sem = (sem_t) malloc(sizeof(struct semaphore));
+	if (new_sem == NULL) {
+		return NULL;
+	}
 
-	new_sem->wait_queue = queue_create();
-	new_sem->count = count;
+	if (sem_init_flags(new_sem, count, flags)) {
+		free(new_sem);
+		return NULL;
+	}
 
 	return new_sem;
 }
 
-int sem_destroy(sem_t sem)
+sem_t sem_create_shared(void *addr, size_t size, size_t count)
 {
-	/* Check for NULL sem or non-empty wait_queue */
+	sem_t new_sem = (sem_t) addr;
+
+	/* Check for NULL, misaligned or too small memory */
+	if (addr == NULL || (uintptr_t)addr % _Alignof(struct semaphore) != 0
+	    || size < sizeof(struct semaphore)) {
+		return NULL;
+	}
+
+	if (sem_init_flags(new_sem, count, SEM_SHARED | SEM_FUTEX)) {
+		return NULL;
+	}
+
+	return new_sem;
+}
+
+int sem_init(sem_t sem, size_t count)
+{
+	return sem_init_flags(sem, count, SEM_DEFAULT_FLAGS);
+}
+
+int sem_init_flags(sem_t sem, size_t count, int flags)
+{
+	int i;
+
+	/* Check for NULL sem, and that the count fits in a futex word */
+	if (sem == NULL || count > INT_MAX) {
+		return -1;
+	}
+
+	/* Futex sleepers cannot be handed resources */
+	if ((flags & SEM_FUTEX) && (flags & SEM_HANDOFF)) {
+		return -1;
+	}
+
+	/* Neither can pollers, and the count is in the kernel */
+	if ((flags & SEM_EVENTFD) && (flags & (SEM_FUTEX | SEM_HANDOFF))) {
+		return -1;
+	}
+
+	/* Other processes can only wait through shared futexes */
+	if ((flags & SEM_SHARED) && (flags & (SEM_HANDOFF | SEM_EVENTFD))) {
+		return -1;
+	} else if (flags & SEM_SHARED) {
+		flags |= SEM_FUTEX;
+	}
+
+	/* Shards are private to the process, and have no waiting order */
+	if ((flags & SEM_SHARDED)
+	    && (flags & (SEM_HANDOFF | SEM_EVENTFD | SEM_SHARED))) {
+		return -1;
+	}
+
+	sem->shards = NULL;
+	sem->nshards = 0;
+	if (flags & SEM_SHARDED) {
+		sem->nshards = sysconf(_SC_NPROCESSORS_ONLN);
+		if (sem->nshards < 1) {
+			sem->nshards = 1;
+		} else if (sem->nshards > SEM_SHARDS_MAX) {
+			sem->nshards = SEM_SHARDS_MAX;
+		}
+
+		sem->shards = aligned_alloc(SEM_CACHELINE,
+					    sem->nshards * sizeof(struct sem_shard));
+		if (sem->shards == NULL) {
+			return -1;
+		}
+
+		/* Start with the resources spread evenly */
+		for (i = 0; i < sem->nshards; i++) {
+			atomic_init(&sem->shards[i].count, count / sem->nshards);
+		}
+		count %= sem->nshards;
+	}
+
+	sem->fd = -1;
+	if (flags & SEM_EVENTFD) {
+		sem->fd = eventfd(count, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+		if (sem->fd == -1) {
+			return -1;
+		}
+		count = 0;
+	}
+
+	lock_init(&sem->lock);
+	waitlist_init(&sem->wait_list);
+	atomic_init(&sem->count, count);
+	atomic_init(&sem->waiters, 0);
+	atomic_init(&sem->bulk_waiters, 0);
+	atomic_init(&sem->any_waiters, 0);
+	atomic_init(&sem->spin, 0);
+	sem->flags = flags;
+	atomic_init(&sem->stats, NULL);
+
+	return 0;
+}
+
+int sem_fini(sem_t sem)
+{
+	/* Check for NULL sem or waiting threads */
 	if (sem == NULL) {
 		return -1;
-	} else if (queue_destroy(sem->wait_queue) == -1) {
+	} else if (atomic_load(&sem->waiters) != 0) {
+		return -1;
+	}
+
+	if (sem->fd != -1) {
+		close(sem->fd);
+		sem->fd = -1;
+	}
+
+	free(sem->shards);
+	sem->shards = NULL;
+	sem->nshards = 0;
+
+#ifdef SEM_STATS
+	free(atomic_load(&sem->stats));
+	atomic_store(&sem->stats, NULL);
+#endif
+
+	return 0;
+}
+
+int sem_destroy(sem_t sem)
+{
+	if (sem_fini(sem)) {
 		return -1;
 	}
 
-	free(sem);
+	/* Shared semaphores belong to the caller's mapping */
+	if (!(sem->flags & SEM_SHARED)) {
+		free(sem);
+	}
 
 	return 0;
 }
 
 int sem_down(sem_t sem)
 {
-	pthread_t tid;
+	return sem_down_n(sem, 1);
+}
 
-	/* Check for NULL sem */
-	if (sem == NULL) {
+int sem_down_n(sem_t sem, size_t n)
+{
+	/* Check for NULL sem or impossible request */
+	if (sem == NULL || n > INT_MAX) {
+		return -1;
+	} else if (n == 0) {
+		return 0;
+	} else if (n > 1 && (sem->flags & SEM_EVENTFD)) {
 		return -1;
 	}
 
-	enter_critical_section();
+	sem_take(sem, n, NULL);
+
+	return 0;
+}
 
-	if (sem->count == 0) {
-		tid = pthread_self();
-		queue_enqueue(sem->wait_queue, (void*)tid);
-		thread_block();
+int sem_trydown(sem_t sem)
+{
+	/* Check for NULL sem */
+	if (sem == NULL) {
+		return -1;
 	}
 
-	sem->count -= 1;
+	if (sem->flags & SEM_EVENTFD) {
+		if (!sem_eventfd_trytake(sem)) {
+			return -1;
+		}
+	} else if (!sem_canbarge(sem) || !sem_fasttake(sem, 1)) {
+		return -1;
+	}
 
-	exit_critical_section();
+	sem_stat_inc(sem, downs);
 
 	return 0;
 }
 
-int sem_up(sem_t sem)
+int sem_timeddown(sem_t sem, const struct timespec *abstime)
+{
+	/* Check for NULL sem or deadline */
+	if (sem == NULL || abstime == NULL) {
+		return -1;
+	}
+
+	return sem_take(sem, 1, abstime);
+}
+
+int sem_down_upto(sem_t sem, size_t n)
 {
-	pthread_t tid;
-	void *ptr;
+	int taken, local, i;
 
 	/* Check for NULL sem */
 	if (sem == NULL) {
 		return -1;
 	}
 
-	enter_critical_section();
+	if (sem->flags & SEM_EVENTFD) {
+		/* The kernel hands out one resource at a time */
+		for (taken = 0; (size_t)taken < n && taken < INT_MAX; taken++) {
+			if (!sem_eventfd_trytake(sem)) {
+				break;
+			}
+		}
+		if (taken > 0) {
+			sem_stat_inc(sem, downs);
+		}
+		return taken;
+	}
 
-	sem->count += 1;
+	if (!sem_canbarge(sem)) {
+		return 0;
+	}
+
+	if (n > INT_MAX) {
+		n = INT_MAX;
+	}
+
+	if (sem->shards == NULL) {
+		taken = sem_counter_takeupto(&sem->count, n);
+	} else {
+		/* Same order as sem_down(), collecting from every counter */
+		local = sem_shard_index(sem);
+		taken = sem_counter_takeupto(&sem->shards[local].count, n);
+		taken += sem_counter_takeupto(&sem->count, n - taken);
+		for (i = 1; i < sem->nshards; i++) {
+			taken += sem_counter_takeupto(
+				&sem->shards[(local + i) % sem->nshards].count,
+				n - taken);
+		}
+	}
+
+	if (taken == 0) {
+		return 0;
+	}
+
+	sem_stat_inc(sem, downs);
+
+	return taken;
+}
+
+int sem_down_any(sem_t *sems, size_t n, size_t *index)
+{
+	struct sem_wait stack_waits[SEM_ANY_STACK], *waits;
+	waitlist_t pending = WAITLIST_INITIALIZER;
+	struct sem_any any;
+	size_t i, registered;
+	int self = 0;
+
+	/* Check for NULL sems or index, or impossible request */
+	if (sems == NULL || index == NULL || n == 0 || n > INT_MAX) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (sems[i] == NULL
+		    || (sems[i]->flags & (SEM_EVENTFD | SEM_SHARED))) {
+			return -1;
+		}
+	}
+
+	/* Fast path: take the first available semaphore */
+	for (i = 0; i < n; i++) {
+		if (sem_canbarge(sems[i]) && sem_fasttake(sems[i], 1)) {
+			sem_stat_inc(sems[i], downs);
+			*index = i;
+			return 0;
+		}
+	}
 
-	if (queue_dequeue(sem->wait_queue, (void**)&ptr) != -1) {
-		tid = (pthread_t) ptr;
-		thread_unblock(tid);
+	waits = stack_waits;
+	if (n > SEM_ANY_STACK) {
+		waits = malloc(n * sizeof(*waits));
+		if (waits == NULL) {
+			return -1;
+		}
 	}
 
-	exit_critical_section();
+	atomic_init(&any.wake, 0);
+	atomic_init(&any.winner, -1);
+
+	/*
+	 * Register in every wait_list, one semaphore at a time, and stop early
+	 * if one of them already gave us a resource
+	 */
+	for (registered = 0; registered < n; ) {
+		sem_t sem = sems[registered];
+		struct sem_wait *wait = &waits[registered];
+		int took = 0, moved;
+
+		wait->n = 1;
+		wait->granted = 0;
+		wait->any = &any;
+		wait->index = registered;
+		lock_waiter_shared(&wait->waiter, &any.wake);
+
+		lock_acquire(&sem->lock);
+		atomic_fetch_add(&sem->any_waiters, 1);
+		sem_waiter_enter(sem);
+		moved = sem_shard_drain(sem);
+
+		/* Check again, a concurrent sem_up() now sees us waiting */
+		if ((!(sem->flags & SEM_HANDOFF) || waitlist_empty(&sem->wait_list))
+		    && sem_trytake(sem, 1)) {
+			took = 1;
+		} else {
+			waitlist_push(&sem->wait_list, &wait->waiter);
+		}
+
+		lock_release(&sem->lock);
+		registered++;
+
+		/* Other threads may be waiting for what was in the shards */
+		if (moved > 0) {
+			sem_wake(sem, moved);
+		}
+
+		if (took) {
+			if (sem_any_claim(wait)) {
+				self = 1;
+			} else {
+				/* Another semaphore was faster */
+				sem_give(sem, 1);
+			}
+			break;
+		} else if (atomic_load(&any.winner) != -1) {
+			break;
+		}
+	}
+
+	/* Sleep until the semaphore which picked us is done with our waiter */
+	if (!self) {
+		while (atomic_load(&any.wake) == 0) {
+			futex_wait(&any.wake, 0);
+		}
+	}
+
+	/* Cancel the other registrations */
+	for (i = 0; i < registered; i++) {
+		sem_t sem = sems[i];
+
+		lock_acquire(&sem->lock);
+
+		/* We may have been holding back the threads behind us */
+		if (waitlist_remove(&sem->wait_list, &waits[i].waiter) == 0) {
+			sem_queue_wake_locked(sem, &pending);
+		}
+
+		atomic_fetch_sub(&sem->any_waiters, 1);
+		atomic_fetch_sub(&sem->waiters, 1);
+
+		lock_release(&sem->lock);
+		lock_unblock_list(&pending);
+	}
+
+	if (waits != stack_waits) {
+		free(waits);
+	}
+
+	*index = atomic_load(&any.winner);
+	sem_stat_inc(sems[*index], downs);
+
+	return 0;
+}
+
+int sem_up(sem_t sem)
+{
+	return sem_up_n(sem, 1);
+}
+
+int sem_up_n(sem_t sem, size_t n)
+{
+	/* Check for NULL sem or impossible release */
+	if (sem == NULL || n > INT_MAX) {
+		return -1;
+	} else if (n == 0) {
+		return 0;
+	}
+
+	sem_give(sem, n);
 
 	return 0;
 }
 
 int sem_getvalue(sem_t sem, int *sval)
 {
+	int count, i;
+
 	/* Check for NULL sem */
 	if (sem == NULL) {
 		return -1;
 	}
 
-	enter_critical_section();
-
-	if (sem->count > 0) {
-		*sval = sem->count;
+	if (sem->flags & SEM_EVENTFD) {
+		count = sem_eventfd_value(sem);
 	} else {
-		*sval = (-1) * queue_length(sem->wait_queue);
+		count = atomic_load(&sem->count);
+		for (i = 0; i < sem->nshards; i++) {
+			count += atomic_load(&sem->shards[i].count);
+		}
 	}
 
-	exit_critical_section();
+	if (count > 0) {
+		*sval = count;
+	} else {
+		*sval = (-1) * atomic_load(&sem->waiters);
+	}
 
 	return 0;
 }
 
+int sem_fd(sem_t sem)
+{
+	/* Check for NULL sem or semaphore without file descriptor */
+	if (sem == NULL || !(sem->flags & SEM_EVENTFD)) {
+		return -1;
+	}
+
+	return sem->fd;
+}
+
+int sem_getstats(sem_t sem, struct sem_stats *stats)
+{
+#ifdef SEM_STATS
+	struct sem_counters *counters;
+	int i;
+
+	/* Check for NULL sem or stats */
+	if (sem == NULL || stats == NULL) {
+		return -1;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	/* Nothing happened on this semaphore yet */
+	counters = atomic_load(&sem->stats);
+	if (counters == NULL) {
+		return 0;
+	}
+
+	stats->downs = atomic_load(&counters->downs);
+	stats->ups = atomic_load(&counters->ups);
+	stats->blocked = atomic_load(&counters->blocked);
+	stats->wait_total_ns = atomic_load(&counters->wait_total_ns);
+	stats->wait_max_ns = atomic_load(&counters->wait_max_ns);
+	for (i = 0; i < SEM_STATS_BUCKETS; i++) {
+		stats->wait_hist[i] = atomic_load(&counters->wait_hist[i]);
+	}
+	stats->max_waiters = atomic_load(&counters->max_waiters);
+
+	return 0;
+#else
+	return -1;
+#endif
+}
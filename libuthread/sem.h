@@ -1,8 +1,13 @@
 #ifndef _SEMAPHORE_H
 #define _SEMAPHORE_H
 
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
+
+#include "lock.h"
 
 /*
  * sem_t - Semaphore type
@@ -15,22 +20,202 @@
  */
 typedef struct semaphore *sem_t;
 
+/*
+ * Semaphore flags
+ *
+ * SEM_FUTEX: Use the futex engine. Blocked threads sleep directly on the
+ * semaphore's count with futex(2) instead of being put in a waiting list, which
+ * saves a lock and an allocation on every blocking sem_down().
+ *
+ * SEM_NOSPIN: Never spin in sem_down(). By default, sem_down() spins for a
+ * short, adaptive amount of time before going to sleep, which is wasted CPU
+ * time on oversubscribed machines. Spinning can also be disabled for the whole
+ * library at build time with `make SPIN=0`.
+ *
+ * SEM_HANDOFF: Hand released resources directly to the oldest waiting thread.
+ * Waiting threads are served in FIFO order and new threads cannot take
+ * resources while others are waiting, which bounds the waiting time. By
+ * default, released resources can be taken by any running thread and woken up
+ * threads try again if they were too late, which gives better throughput.
+ * Implies SEM_NOSPIN, and cannot be combined with SEM_FUTEX.
+ *
+ * SEM_EVENTFD: Keep the count in an eventfd(2) counter in semaphore mode,
+ * returned by sem_fd(), instead of in memory. The file descriptor is readable
+ * whenever a resource is available, so that the semaphore can be watched with
+ * poll(2) or epoll(7) along with other file descriptors, and then taken with
+ * sem_trydown(). Every operation costs a system call. sem_down_n() for more
+ * than one resource and sem_down_any() are not supported, and such
+ * semaphores cannot be statically initialized. Cannot be combined with
+ * SEM_FUTEX or SEM_HANDOFF.
+ *
+ * SEM_SHARED: Make the semaphore usable by several processes, when it lives in
+ * memory shared between them (see sem_create_shared()). Implies SEM_FUTEX,
+ * with futexes shared between processes. Statistics are not collected, and
+ * sem_down_any() is not supported. Cannot be combined with SEM_HANDOFF or
+ * SEM_EVENTFD.
+ *
+ * SEM_SHARDED: Spread the available resources over per-thread-group shards,
+ * one per CPU, each on its own cache line. sem_up() puts resources in the
+ * shard of the calling thread and sem_down() takes from it first, then from
+ * the other shards, and only goes to sleep once they are all empty, so that
+ * large pools of resources used from every CPU do not bounce a single count
+ * between them. Meant for semaphores with a large count, as resources may sit
+ * in the shard of a thread that does not need them. Needs sem_create_flags()
+ * or sem_init_flags(), the static initializer ignores it. Cannot be combined
+ * with SEM_HANDOFF, SEM_EVENTFD or SEM_SHARED.
+ */
+#define SEM_FUTEX	0x1
+#define SEM_NOSPIN	0x2
+#define SEM_HANDOFF	0x4
+#define SEM_EVENTFD	0x8
+#define SEM_SHARED	0x10
+#define SEM_SHARDED	0x20
+
+/*
+ * SEM_DEFAULT_FLAGS - Flags used by sem_create()
+ *
+ * Can be overridden at build time, e.g. `make FUTEX=1` builds the library with
+ * the futex engine as default.
+ */
+#ifndef SEM_DEFAULT_FLAGS
+#define SEM_DEFAULT_FLAGS	0
+#endif
+
+/*
+ * struct semaphore - Semaphore object
+ *
+ * The layout is only public so that semaphores can be embedded in the objects
+ * they guard, or defined statically, instead of being allocated by
+ * sem_create(). Its members are private and must not be accessed directly.
+ */
+struct sem_counters;
+struct sem_shard;
+
+struct semaphore {
+	lock_t lock;
+	waitlist_t wait_list;
+	atomic_int count;
+	atomic_int waiters;
+	atomic_int bulk_waiters;
+	atomic_int any_waiters;
+	atomic_int spin;
+	int flags;
+	int fd;
+	_Atomic(struct sem_counters *) stats;
+	struct sem_shard *shards;
+	int nshards;
+};
+
+/*
+ * SEM_INITIALIZER_FLAGS - Static initializer for a semaphore with flags
+ * @count: Semaphore count, at most INT_MAX
+ * @flags: Semaphore flags, which must be a valid combination
+ *
+ * Unlike sem_init_flags(), arguments are not checked.
+ */
+#define SEM_INITIALIZER_FLAGS(count, flags) \
+	{ LOCK_INITIALIZER, WAITLIST_INITIALIZER, (count), 0, 0, 0, 0, (flags), \
+	  -1, NULL, NULL, 0 }
+
+/*
+ * SEM_INITIALIZER - Static initializer for a semaphore
+ * @count: Semaphore count, at most INT_MAX
+ *
+ * Uses the value of SEM_DEFAULT_FLAGS seen by the code using the initializer.
+ */
+#define SEM_INITIALIZER(count) SEM_INITIALIZER_FLAGS(count, SEM_DEFAULT_FLAGS)
+
 /*
  * sem_create - Create semaphore
  * @count: Semaphore count
  *
- * Allocate and initialize a semaphore of internal count @count.
+ * Allocate and initialize a semaphore of internal count @count, using
+ * SEM_DEFAULT_FLAGS.
  *
  * Return: Pointer to initialized semaphore. NULL in case of failure when
  * allocating the new semaphore.
  */
 sem_t sem_create(size_t count);
 
+/*
+ * sem_create_flags - Create semaphore with flags
+ * @count: Semaphore count
+ * @flags: Semaphore flags (e.g. SEM_FUTEX)
+ *
+ * Allocate and initialize a semaphore of internal count @count, whose
+ * behavior is selected by @flags.
+ *
+ * Return: Pointer to initialized semaphore. NULL if @count does not fit in an
+ * int, if @flags is an invalid combination, or in case of failure when
+ * allocating the new semaphore.
+ */
+sem_t sem_create_flags(size_t count, int flags);
+
+/*
+ * sem_create_shared - Create process-shared semaphore
+ * @addr: Address where the semaphore is placed, in a MAP_SHARED mapping
+ * @size: Size available at @addr
+ * @count: Semaphore count
+ *
+ * Initialize a SEM_SHARED semaphore of internal count @count at @addr, so that
+ * all the processes mapping the same memory can use it through their own
+ * address for it. Only one process initializes the semaphore, and it must be
+ * finalized with sem_fini() (or sem_destroy(), which does not free anything
+ * in this case) once no process uses it anymore.
+ *
+ * Return: @addr as a semaphore. NULL if @addr is NULL or not suitably aligned,
+ * if @size is smaller than sizeof(struct semaphore), or if @count does not fit
+ * in an int.
+ */
+sem_t sem_create_shared(void *addr, size_t size, size_t count);
+
+/*
+ * sem_init - Initialize semaphore
+ * @sem: Semaphore to initialize
+ * @count: Semaphore count
+ *
+ * Initialize semaphore @sem, provided by the caller, with internal count
+ * @count and SEM_DEFAULT_FLAGS. Unlike sem_create(), this never allocates
+ * memory.
+ *
+ * Return: -1 if @sem is NULL or if @count does not fit in an int. 0 if @sem
+ * was successfully initialized.
+ */
+int sem_init(sem_t sem, size_t count);
+
+/*
+ * sem_init_flags - Initialize semaphore with flags
+ * @sem: Semaphore to initialize
+ * @count: Semaphore count
+ * @flags: Semaphore flags (e.g. SEM_FUTEX)
+ *
+ * Initialize semaphore @sem, provided by the caller, with internal count
+ * @count and behavior selected by @flags.
+ *
+ * Return: -1 if @sem is NULL, if @count does not fit in an int, if @flags is
+ * an invalid combination, or if the eventfd of a SEM_EVENTFD semaphore could
+ * not be created. 0 if @sem was successfully initialized.
+ */
+int sem_init_flags(sem_t sem, size_t count, int flags);
+
+/*
+ * sem_fini - Finalize a semaphore
+ * @sem: Semaphore to finalize
+ *
+ * Release the resources held by semaphore @sem, which was initialized with
+ * sem_init() or SEM_INITIALIZER. The storage of @sem itself belongs to the
+ * caller and is not freed.
+ *
+ * Return: -1 if @sem is NULL or if other threads are still being blocked on
+ * @sem. 0 if @sem was successfully finalized.
+ */
+int sem_fini(sem_t sem);
+
 /*
  * sem_destroy - Deallocate a semaphore
  * @sem: Semaphore to deallocate
  *
- * Deallocate semaphore @sem.
+ * Deallocate semaphore @sem, which must have been created with sem_create().
  *
  * Return: -1 if @sem is NULL or if other threads are still being blocked on
  * @sem. 0 is @sem was successfully destroyed.
@@ -50,6 +235,79 @@ int sem_destroy(sem_t sem);
  */
 int sem_down(sem_t sem);
 
+/*
+ * sem_trydown - Take a semaphore without blocking
+ * @sem: Semaphore to take
+ *
+ * Take a resource from semaphore @sem if one is available right away.
+ *
+ * Return: -1 if @sem is NULL or if no resource is available. 0 if semaphore
+ * was successfully taken.
+ */
+int sem_trydown(sem_t sem);
+
+/*
+ * sem_timeddown - Take a semaphore with a deadline
+ * @sem: Semaphore to take
+ * @abstime: Absolute deadline, measured against CLOCK_REALTIME
+ *
+ * Take a resource from semaphore @sem, like sem_down(), but give up if the
+ * semaphore is still unavailable when @abstime is reached. A thread giving up
+ * leaves the waiting list and never consumes a resource.
+ *
+ * Return: -1 if @sem or @abstime are NULL, or if @abstime was reached. 0 if
+ * semaphore was successfully taken.
+ */
+int sem_timeddown(sem_t sem, const struct timespec *abstime);
+
+/*
+ * sem_down_n - Take several resources from a semaphore
+ * @sem: Semaphore to take
+ * @n: Number of resources to take
+ *
+ * Take @n resources from semaphore @sem in a single step: the caller thread is
+ * blocked until @n resources are available at the same time, and then takes
+ * all of them at once.
+ *
+ * Return: -1 if @sem is NULL, if @n is greater than INT_MAX, or if @n is
+ * greater than 1 and @sem uses SEM_EVENTFD. 0 if the resources were
+ * successfully taken.
+ */
+int sem_down_n(sem_t sem, size_t n);
+
+/*
+ * sem_down_upto - Take available resources from a semaphore
+ * @sem: Semaphore to take
+ * @n: Maximum number of resources to take
+ *
+ * Take as many resources as currently available from semaphore @sem, up to
+ * @n, in a single step. This function never blocks. With SEM_SHARDED, the
+ * resources are collected from one shard after the other.
+ *
+ * Return: -1 if @sem is NULL. Number of resources taken otherwise, between 0
+ * and @n.
+ */
+int sem_down_upto(sem_t sem, size_t n);
+
+/*
+ * sem_down_any - Take any of several semaphores
+ * @sems: Array of semaphores
+ * @n: Number of semaphores in @sems
+ * @index: Address of data item where the index of the taken semaphore is
+ *         received
+ *
+ * Take a resource from whichever semaphore of @sems becomes available first,
+ * blocking until one does. The caller thread waits on all the semaphores at
+ * once, and is only ever given a resource from one of them. When several
+ * semaphores are available right away, the first one in @sems is taken.
+ *
+ * Return: -1 if @sems, one of its semaphores or @index are NULL, if one of the
+ * semaphores uses SEM_EVENTFD or SEM_SHARED, if @n is 0 or greater than
+ * INT_MAX, or in case of failure when allocating memory for more than a few
+ * semaphores. 0 if a semaphore was successfully taken.
+ */
+int sem_down_any(sem_t *sems, size_t n, size_t *index);
+
 /*
  * sem_up - Release a semaphore
  * @sem: Semaphore to release
@@ -64,13 +322,27 @@ int sem_down(sem_t sem);
  */
 int sem_up(sem_t sem);
 
+/*
+ * sem_up_n - Release several resources to a semaphore
+ * @sem: Semaphore to release
+ * @n: Number of resources to release
+ *
+ * Release @n resources to semaphore @sem in a single step, and unblock as many
+ * threads from the waiting list as these resources can satisfy.
+ *
+ * Return: -1 if @sem is NULL or if @n is greater than INT_MAX. 0 if the
+ * resources were successfully released.
+ */
+int sem_up_n(sem_t sem, size_t n);
+
 /*
  * sem_getvalue - Inspect semaphore's internal state
  * @sem: Semaphore to inspect
  * @sval: Address of data item where value is received
  *
  * If semaphore @sem's internal count is greater than 0, assign internal count
- * to data item pointed by @sval.
+ * to data item pointed by @sval. With SEM_SHARDED, the count is the sum of the
+ * shards, which is only a snapshot if the semaphore is in use.
  *
  * If semaphore @sems's internal count is equal to 0, assign a negative number
  * whose absolute value is the count of the number of threads currently blocked
@@ -81,4 +353,57 @@ int sem_up(sem_t sem);
  */
 int sem_getvalue(sem_t sem, int *sval);
 
+/*
+ * sem_fd - Get semaphore's file descriptor
+ * @sem: Semaphore created with SEM_EVENTFD
+ *
+ * The returned file descriptor is owned by @sem and is closed when @sem is
+ * destroyed. It must only be used to wait for @sem to become available, e.g.
+ * with poll(2) or epoll(7).
+ *
+ * Return: -1 if @sem is NULL or was not created with SEM_EVENTFD. The eventfd
+ * file descriptor backing @sem otherwise.
+ */
+int sem_fd(sem_t sem);
+
+/*
+ * Number of buckets in the waiting time histogram of struct sem_stats
+ */
+#define SEM_STATS_BUCKETS 8
+
+/*
+ * struct sem_stats - Semaphore contention statistics
+ * @downs: Number of successful sem_down*() calls
+ * @ups: Number of sem_up*() calls
+ * @blocked: Number of sem_down*() calls which had to block
+ * @wait_total_ns: Cumulative time spent blocked, in nanoseconds
+ * @wait_max_ns: Longest time spent blocked by a single call, in nanoseconds
+ * @wait_hist: Histogram of blocking times: bucket 0 counts waits under 1us,
+ *             bucket i counts waits between 10^(i-1)us and 10^i us, and the
+ *             last bucket counts everything above
+ * @max_waiters: Highest number of threads blocked at the same time
+ */
+struct sem_stats {
+	uint64_t downs;
+	uint64_t ups;
+	uint64_t blocked;
+	uint64_t wait_total_ns;
+	uint64_t wait_max_ns;
+	uint64_t wait_hist[SEM_STATS_BUCKETS];
+	int max_waiters;
+};
+
+/*
+ * sem_getstats - Get semaphore's contention statistics
+ * @sem: Semaphore to inspect
+ * @stats: Address of the structure receiving the statistics
+ *
+ * Statistics are only collected when the library is built with `make STATS=1`,
+ * and cost nothing otherwise.
+ *
+ * Return: -1 if @sem or @stats are NULL, or if the library was built without
+ * statistics. 0 if @stats was successfully filled.
+ */
+int sem_getstats(sem_t sem, struct sem_stats *stats);
+
 #endif /* _SEMAPHORE_H */
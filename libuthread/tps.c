@@ -1,6 +1,8 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <assert.h>
 #include <pthread.h>
@@ -9,93 +11,391 @@
 #include <string.h>
 #include <sys/mman.h>
 
-#include "queue.h"
-#include "thread.h"
+#include "lock.h"
 #include "tps.h"
 
 /***** Data Structures *****/
+#ifndef TPS_MEMFD
+/*
+ * A page of TPS memory, which may be shared by several TPS areas after a
+ * clone. A page is protected by its own lock, which serializes the accesses of
+ * the threads sharing it (mprotect() toggling and copy-on-write). Its
+ * @ref_count is the number of page tables holding it: a reference is only
+ * taken from a table which holds one, under the lock of its tps, and the page
+ * is freed by whoever drops the last one, with no lock held.
+ */
 typedef struct page {
+	lock_t lock;
 	char *ptr;
-	unsigned int ref_count;
+	atomic_uint ref_count;
 } *page_t;
 
+/*
+ * The memory of a TPS area is @size bytes, a multiple of TPS_SIZE, made of the
+ * pages in @pages, of @page_size bytes each. Each page is copied on its own
+ * when written while shared, so that a write after a clone only copies what it
+ * touches. Pages are TPS_SIZE bytes, or huge pages in areas large enough for
+ * them, whose last page may then extend beyond @size. The sizes never change,
+ * and are the same for all the threads sharing pages.
+ *
+ * The lock guards @pages: the owner holds it while accessing its pages, which
+ * it alone swaps or frees, and threads cloning the tps hold it while taking
+ * their references. It is always taken before any page lock.
+ *
+ * Threads cloning a tps @pins it under tps_lock, so that it stays around while
+ * they wait for its pages without holding tps_lock. A tps destroyed by its
+ * owner meanwhile is only marked @destroyed, and freed by the last of them.
+ */
 typedef struct tps {
 	pthread_t tid;
-	page_t page;
+	lock_t lock;
+	page_t *pages;
+	size_t size;
+	size_t page_size;
+	unsigned int pins;
+	int destroyed;
+	struct tps *next;
 } *tps_t;
+#else
+/*
+ * A memfd holding the memory of TPS areas, with the number of areas mapping
+ * it. Once shared by a clone, a file is never written to again: every area
+ * maps it privately, and the kernel copies the pages each area writes.
+ */
+struct tps_file {
+	int fd;
+	atomic_uint ref_count;
+};
+
+/*
+ * The memory of a TPS area is @size bytes at @ptr, a mapping of @file. An area
+ * which was never cloned maps its file @shared, and writes to it directly.
+ * Otherwise it is a private mapping, @dirty once written to, and then no
+ * longer the same as its file. The lock serializes the accesses of the owner
+ * with the threads cloning the area.
+ *
+ * @pins and @destroyed are as without TPS_MEMFD.
+ */
+typedef struct tps {
+	pthread_t tid;
+	lock_t lock;
+	char *ptr;
+	size_t size;
+	struct tps_file *file;
+	int shared;
+	int dirty;
+	unsigned int pins;
+	int destroyed;
+	struct tps *next;
+} *tps_t;
+#endif
+
+/*
+ * All the TPS areas, hashed by tid into @buckets, each bucket being a chain of
+ * tps linked by their @next. The number of buckets is a power of two, doubled
+ * whenever there are more areas than buckets, so that chains stay short
+ * however many threads have a TPS.
+ */
+struct tps_table {
+	tps_t *buckets;
+	size_t nbuckets;
+	size_t count;
+};
+
+/* Number of buckets of the table when the first TPS is created */
+#define TPS_TABLE_MIN	16
+
+/*
+ * Address index: a radix tree over page numbers, mapping every page of TPS
+ * memory to its owner (its page struct, or its tps with TPS_MEMFD), which
+ * segv_handler() looks up. Each level
+ * resolves TPS_INDEX_BITS bits of the page number, so that the tree covers
+ * the 48-bit user address space. Nodes are only ever added, with a
+ * compare-and-swap, and entries are set and cleared with atomic stores, so
+ * lookups need no lock and are safe from a signal handler.
+ */
+#define TPS_PAGE_SHIFT	12
+#define TPS_INDEX_BITS	12
+#define TPS_INDEX_LEVELS	3
+#define TPS_INDEX_FANOUT	(1 << TPS_INDEX_BITS)
+
+struct tps_index_node {
+	_Atomic(void *) slots[TPS_INDEX_FANOUT];
+};
+
+/*
+ * Size of a transparent huge page. Areas at least this large are aligned on
+ * it and advised to use huge pages, so that a large working set takes a few
+ * TLB entries instead of one per TPS_SIZE page.
+ */
+#define TPS_HUGEPAGE_SIZE	(2 * 1024 * 1024)
 
 /***** Global Variables *****/
-static queue_t tps_queue = NULL;
+static struct tps_table tps_table;
+static lock_t tps_lock = LOCK_INITIALIZER;
+static struct tps_index_node tps_index;
+
+/*
+ * TPS of the calling thread, if any. A thread only ever accesses its own TPS,
+ * which it finds here without searching tps_table or taking tps_lock. The tps
+ * itself stays the same for the whole life of the TPS, only its memory changes.
+ */
+static __thread tps_t tps_self;
+
+/*
+ * Memory of the TPS of the calling thread while it is open for a session, and
+ * the mode of the session. Reads and writes within the session go straight to
+ * it.
+ */
+static __thread char *tps_session;
+static __thread int tps_session_mode;
 
 /***** Internal Functions *****/
-/* Enqueue item, if queue is null, create queue */
-static void tps_queue_enqueue_check(queue_t *queue, void *data)
+/*
+ * Bucket of @tid in a table of @nbuckets buckets. Thread ids are addresses of
+ * thread descriptors, with many identical low bits, hence the multiplicative
+ * mixing.
+ */
+static size_t tps_hash(pthread_t tid, size_t nbuckets)
 {
-	/* If the queue is null, allocate a new queue */
-	if (*queue == NULL){
-		*queue = queue_create();
-	} 
-	
-	queue_enqueue(*queue, data);
+	uint64_t h = (uint64_t)tid * 0x9e3779b97f4a7c15ULL;
 
-	return;
+	return (size_t)(h >> 32) & (nbuckets - 1);
 }
 
-/* Delete item, if queue is empty, deallocate and set to NULL */
-static void tps_queue_delete_check(queue_t *queue, void *data)
+/* Find tps for associated TID, with tps_lock held */
+static tps_t tps_table_find(pthread_t tid)
 {
-	/* delete item */
-	queue_delete(*queue, data); 
+	tps_t tps;
 
-	/* If the queue is empty, destroy and set to NULL */
-	if (queue_length(*queue) == 0){
-		queue_destroy(*queue);
-		*queue = NULL;
+	if (tps_table.count == 0) {
+		return NULL;
 	}
 
-	return;
+	tps = tps_table.buckets[tps_hash(tid, tps_table.nbuckets)];
+	while (tps != NULL && tps->tid != tid) {
+		tps = tps->next;
+	}
+
+	return tps;
 }
 
-/* Find tps for associated TID */
-static int find_tid(void *data, void *arg)
+/* Rehash every tps into @nbuckets buckets. Return -1 if out of memory */
+static int tps_table_resize(size_t nbuckets)
 {
-    tps_t tps = (tps_t)data;
-    pthread_t tid = (pthread_t)arg;
+	tps_t *buckets, tps, next;
+	size_t i, h;
 
-    if (tps->tid == tid) {
-        return 1;
-    }
+	buckets = (tps_t*) calloc(nbuckets, sizeof(tps_t));
+	if (buckets == NULL) {
+		return -1;
+	}
 
-    return 0;
+	for (i = 0; i < tps_table.nbuckets; i++) {
+		for (tps = tps_table.buckets[i]; tps != NULL; tps = next) {
+			next = tps->next;
+			h = tps_hash(tps->tid, nbuckets);
+			tps->next = buckets[h];
+			buckets[h] = tps;
+		}
+	}
+
+	free(tps_table.buckets);
+	tps_table.buckets = buckets;
+	tps_table.nbuckets = nbuckets;
+
+	return 0;
 }
-/* Find tps for associated pointer */
-static int find_ptr(void *data, void *arg)
+
+/*
+ * Make room for one more tps, with tps_lock held, so that the following
+ * tps_table_insert() cannot fail. Return -1 if out of memory.
+ */
+static int tps_table_reserve(void)
 {
-    tps_t tps = (tps_t)data;
+	/* Grow the table to keep chains short */
+	if (tps_table.count >= tps_table.nbuckets) {
+		return tps_table_resize(tps_table.nbuckets ? tps_table.nbuckets * 2
+							   : TPS_TABLE_MIN);
+	}
 
-    if ((void*)tps->page->ptr == arg) {
-        return 1;
-    }
+	return 0;
+}
+
+/* Insert tps, with tps_lock held, after tps_table_reserve() */
+static void tps_table_insert(tps_t tps)
+{
+	size_t h = tps_hash(tps->tid, tps_table.nbuckets);
+
+	tps->next = tps_table.buckets[h];
+	tps_table.buckets[h] = tps;
+	tps_table.count++;
+}
+
+/* Remove tps, with tps_lock held. If the table is empty, deallocate it */
+static void tps_table_remove(tps_t tps)
+{
+	tps_t *link = &tps_table.buckets[tps_hash(tps->tid, tps_table.nbuckets)];
+
+	while (*link != tps) {
+		link = &(*link)->next;
+	}
+	*link = tps->next;
+
+	if (--tps_table.count == 0) {
+		free(tps_table.buckets);
+		tps_table.buckets = NULL;
+		tps_table.nbuckets = 0;
+	}
+}
+
+/* Slot of tps_index's radix tree at @level for page number @pn */
+static size_t tps_index_slot(uintptr_t pn, int level)
+{
+	return (pn >> ((TPS_INDEX_LEVELS - 1 - level) * TPS_INDEX_BITS))
+		& (TPS_INDEX_FANOUT - 1);
+}
+
+/*
+ * Find the leaf of the radix tree covering the page at @addr, allocating the
+ * missing nodes if @create. Return NULL if there is none.
+ */
+static struct tps_index_node *tps_index_leaf(uintptr_t addr, int create)
+{
+	struct tps_index_node *node = &tps_index, *child;
+	void *expected;
+	uintptr_t pn = addr >> TPS_PAGE_SHIFT;
+	int level;
+
+	/* Beyond the address space covered by the tree */
+	if (pn >> (TPS_INDEX_LEVELS * TPS_INDEX_BITS)) {
+		return NULL;
+	}
+
+	for (level = 0; level < TPS_INDEX_LEVELS - 1; level++) {
+		_Atomic(void *) *slot = &node->slots[tps_index_slot(pn, level)];
+
+		child = atomic_load_explicit(slot, memory_order_acquire);
+		if (child == NULL) {
+			if (!create) {
+				return NULL;
+			}
+
+			child = calloc(1, sizeof(struct tps_index_node));
+			if (child == NULL) {
+				return NULL;
+			}
+
+			/* Another thread may have added the same node */
+			expected = NULL;
+			if (!atomic_compare_exchange_strong(slot, &expected,
+							    child)) {
+				free(child);
+				child = expected;
+			}
+		}
+		node = child;
+	}
+
+	return node;
+}
+
+/*
+ * Map the @size bytes of TPS memory at @ptr to @owner in the index, or remove
+ * them if @owner is NULL. Return -1 if out of memory.
+ */
+static int tps_index_set(char *ptr, size_t size, void *owner)
+{
+	struct tps_index_node *leaf;
+	uintptr_t addr;
+
+	for (addr = (uintptr_t)ptr; addr < (uintptr_t)ptr + size;
+	     addr += TPS_SIZE) {
+		leaf = tps_index_leaf(addr, owner != NULL);
+		if (leaf == NULL) {
+			/* Nothing to clear, or leave no half-indexed area */
+			if (owner != NULL) {
+				tps_index_set(ptr, addr - (uintptr_t)ptr, NULL);
+				return -1;
+			}
+			continue;
+		}
+
+		atomic_store_explicit(&leaf->slots[tps_index_slot(
+					addr >> TPS_PAGE_SHIFT,
+					TPS_INDEX_LEVELS - 1)],
+				      owner, memory_order_release);
+	}
+
+	return 0;
+}
+
+/* Find the owner of the TPS memory at @addr. Async-signal-safe */
+static void *tps_index_find(void *addr)
+{
+	struct tps_index_node *leaf = tps_index_leaf((uintptr_t)addr, 0);
+
+	if (leaf == NULL) {
+		return NULL;
+	}
+
+	return atomic_load_explicit(&leaf->slots[tps_index_slot(
+					(uintptr_t)addr >> TPS_PAGE_SHIFT,
+					TPS_INDEX_LEVELS - 1)],
+				    memory_order_acquire);
+}
+/*
+ * Map @size bytes of protected memory for a TPS area, anonymous memory if @fd
+ * is -1 or else file @fd, with mmap() @flags. Return MAP_FAILED in case of
+ * failure.
+ */
+static void *tps_map(size_t size, int flags, int fd)
+{
+	char *ptr, *aligned;
+	size_t head;
+
+	if (size < TPS_HUGEPAGE_SIZE) {
+		return mmap(NULL, size, PROT_NONE, flags, fd, 0);
+	}
+
+	/* Reserve enough to align the area on a huge page, then trim */
+	ptr = mmap(NULL, size + TPS_HUGEPAGE_SIZE, PROT_NONE,
+		   MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (ptr == MAP_FAILED) {
+		return MAP_FAILED;
+	}
+
+	aligned = (char*)(((uintptr_t)ptr + TPS_HUGEPAGE_SIZE - 1)
+			  & ~(uintptr_t)(TPS_HUGEPAGE_SIZE - 1));
+	if (fd != -1 && mmap(aligned, size, PROT_NONE, flags | MAP_FIXED, fd, 0)
+			== MAP_FAILED) {
+		munmap(ptr, size + TPS_HUGEPAGE_SIZE);
+		return MAP_FAILED;
+	}
+	head = aligned - ptr;
+	if (head > 0) {
+		munmap(ptr, head);
+	}
+	munmap(aligned + size, TPS_HUGEPAGE_SIZE - head);
+
+	/* Only a hint, the area works all the same without huge pages */
+	madvise(aligned, size, MADV_HUGEPAGE);
 
-    return 0;
+	return aligned;
 }
+
 /* Handler for seg fault on tps access */
 static void segv_handler(int sig, siginfo_t *si, void *context)
 {
-    /*
-     * Get the address corresponding to the beginning of the page where the
-     * fault occurred
-     */
-    void *p_fault = (void*)((uintptr_t)si->si_addr & ~(TPS_SIZE - 1));
-	void *void_ptr = NULL;
+    static const char msg[] = "TPS protection error!\n";
 
     /*
-     * Iterate through all the TPS areas and find if p_fault matches one of them
+     * Look the faulting address up in the address index, which is safe to
+     * do from a signal handler, whatever the interrupted thread was doing
      */
-	queue_iterate(tps_queue, find_ptr, p_fault, &void_ptr);
-    if (void_ptr != NULL) {
-        /* Printf the following error message */
-        fprintf(stderr, "TPS protection error!\n");
+    if (tps_index_find(si->si_addr) != NULL) {
+        /* Print the following error message, with async-signal-safe write() */
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
 	}
 
     /* In any case, restore the default signal handlers */
@@ -129,91 +429,765 @@ int tps_init(int segv)
 	return 0;
 }
 
+#ifndef TPS_MEMFD
+/*
+ * Lock pages @first to @last of a tps, with its lock held so that its pages
+ * stay the same. Pages are only ever shared at the same index, so locking them
+ * in increasing order never deadlocks.
+ */
+static void tps_lock_pages(tps_t tps, size_t first, size_t last)
+{
+	size_t i;
+
+	for (i = first; i <= last; i++) {
+		lock_acquire(&tps->pages[i]->lock);
+	}
+}
+
+static void tps_unlock_pages(tps_t tps, size_t first, size_t last)
+{
+	size_t i;
+
+	for (i = first; i <= last; i++) {
+		lock_release(&tps->pages[i]->lock);
+	}
+}
+
+/* Number of pages of a tps, the last of which may extend beyond its size */
+static size_t tps_npages(tps_t tps)
+{
+	return (tps->size + tps->page_size - 1) / tps->page_size;
+}
+
+/*
+ * Change the protection of the locked pages @first to @last of a tps, with one
+ * mprotect() per run of pages which are contiguous in memory: a single one
+ * unless some of the pages were copied on write.
+ */
+static void tps_protect(tps_t tps, size_t first, size_t last, int prot)
+{
+	size_t i, run;
+
+	for (i = first; i <= last; i = run) {
+		for (run = i + 1; run <= last; run++) {
+			if (tps->pages[run]->ptr
+			    != tps->pages[run - 1]->ptr + tps->page_size) {
+				break;
+			}
+		}
+		mprotect(tps->pages[i]->ptr, (run - i) * tps->page_size, prot);
+	}
+}
+
+/* Copy @length bytes between @buffer and a tps at @offset, page by page */
+static void tps_copy(tps_t tps, size_t offset, size_t length, char *buffer,
+		     int write)
+{
+	size_t in_page, chunk;
+	char *ptr;
+
+	while (length > 0) {
+		in_page = offset % tps->page_size;
+		chunk = tps->page_size - in_page;
+		if (chunk > length) {
+			chunk = length;
+		}
+
+		ptr = tps->pages[offset / tps->page_size]->ptr + in_page;
+		if (write) {
+			memcpy(ptr, buffer, chunk);
+		} else {
+			memcpy(buffer, ptr, chunk);
+		}
+
+		offset += chunk;
+		buffer += chunk;
+		length -= chunk;
+	}
+}
+
+/* Create the page struct of the page of @size bytes at @ptr, and index it */
+static page_t tps_page_create(char *ptr, size_t size)
+{
+	page_t page;
+
+	page = (page_t) malloc(sizeof(struct page));
+	if (page == NULL) {
+		return NULL;
+	}
+
+	lock_init(&page->lock);
+	page->ptr = ptr;
+	atomic_init(&page->ref_count, 1);
+
+	/* Let the fault handler recognize the new page */
+	if (tps_index_set(ptr, size, page)) {
+		free(page);
+		return NULL;
+	}
+
+	return page;
+}
+
+/*
+ * Drop a reference to the first @npages of @pages, of @page_size bytes each,
+ * which the caller no longer holds locked, unmapping the pages nobody uses
+ * anymore, as few runs of contiguous pages as possible. Nobody else can reach
+ * a page once its last reference is dropped, so it is freed without locking.
+ */
+static void tps_release_pages(page_t *pages, size_t npages, size_t page_size)
+{
+	char *run = NULL;
+	size_t i, run_size = 0;
+	page_t page;
+
+	for (i = 0; i < npages; i++) {
+		page = pages[i];
+		if (atomic_fetch_sub(&page->ref_count, 1) != 1) {
+			continue;
+		}
+
+		tps_index_set(page->ptr, page_size, NULL);
+		if (page->ptr != run + run_size) {
+			if (run_size > 0) {
+				munmap(run, run_size);
+			}
+			run = page->ptr;
+			run_size = 0;
+		}
+		run_size += page_size;
+		free(page);
+	}
+
+	if (run_size > 0) {
+		munmap(run, run_size);
+	}
+}
+
+/*
+ * Copy on write of the locked and shared page @i of a tps: give the tps its
+ * own copy of the page, locked in turn. Return -1 in case of failure.
+ */
+static int tps_page_copy(tps_t tps, size_t i)
+{
+	page_t page = tps->pages[i];
+	page_t new_page;
+	void *void_ptr;
+
+	/* Allocate memory and check for proper allocation */
+	void_ptr = tps_map(tps->page_size, MAP_PRIVATE | MAP_ANON, -1);
+	if (void_ptr == MAP_FAILED) {
+		return -1;
+	}
+
+	new_page = tps_page_create((char*) void_ptr, tps->page_size);
+	if (new_page == NULL) {
+		munmap(void_ptr, tps->page_size);
+		return -1;
+	}
+	lock_acquire(&new_page->lock);
+
+	/* Unprotect memory, copy, and protect memory */
+	mprotect(new_page->ptr, tps->page_size, PROT_READ | PROT_WRITE);
+	mprotect(page->ptr, tps->page_size, PROT_READ);
+	memcpy(new_page->ptr, page->ptr, tps->page_size);
+	mprotect(new_page->ptr, tps->page_size, PROT_NONE);
+	mprotect(page->ptr, tps->page_size, PROT_NONE);
+
+	/*
+	 * Swap the pages while the shared page is still locked. tps_self
+	 * points to the tps, not the page, so it follows the swap. The other
+	 * threads sharing the page may all have dropped it meanwhile, so only
+	 * drop this reference once done with its lock.
+	 */
+	tps->pages[i] = new_page;
+	lock_release(&page->lock);
+	tps_release_pages(&page, 1, tps->page_size);
+
+	return 0;
+}
+
+/*
+ * Allocate @npages new pages of @page_size bytes into the page table @pages,
+ * as a single mapping. Return -1 in case of failure.
+ */
+static int tps_pages_create(page_t *pages, size_t npages, size_t page_size)
+{
+	size_t i, size = npages * page_size;
+	void *void_ptr;
+
+	/* Allocate memory and check for proper allocation */
+	void_ptr = tps_map(size, MAP_PRIVATE | MAP_ANON, -1);
+	if (void_ptr == MAP_FAILED) {
+		return -1;
+	}
+
+	/* One page struct per page, so that pages can be copied on their own */
+	for (i = 0; i < npages; i++) {
+		pages[i] = tps_page_create((char*) void_ptr + i * page_size,
+					   page_size);
+		if (pages[i] == NULL) {
+			tps_release_pages(pages, i, page_size);
+			munmap((char*) void_ptr + i * page_size,
+			       size - i * page_size);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Map the memory of a new tps of @tps->size bytes, with one page struct per
+ * page. Areas large enough for huge pages are made of huge pages, so that
+ * protecting a page never splits one. Return -1 in case of failure.
+ */
+static int tps_area_create(tps_t tps)
+{
+	lock_init(&tps->lock);
+	tps->page_size = tps->size < TPS_HUGEPAGE_SIZE ? TPS_SIZE
+						       : TPS_HUGEPAGE_SIZE;
+
+	tps->pages = (page_t*) malloc(tps_npages(tps) * sizeof(page_t));
+	if (tps->pages == NULL) {
+		return -1;
+	} else if (tps_pages_create(tps->pages, tps_npages(tps),
+				    tps->page_size)) {
+		free(tps->pages);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Decrement page reference counts
+ * -If 0: Unmap memory and free page data
+ */
+static void tps_area_destroy(tps_t tps)
+{
+	tps_release_pages(tps->pages, tps_npages(tps), tps->page_size);
+	free(tps->pages);
+}
+
+static int tps_area_read(tps_t tps, size_t offset, size_t length, char *buffer)
+{
+	size_t first, last;
+
+	/* Only the pages being read are locked and unprotected */
+	first = offset / tps->page_size;
+	last = (offset + length - 1) / tps->page_size;
+	lock_acquire(&tps->lock);
+	tps_lock_pages(tps, first, last);
+
+	/* Allow temporary read access */
+	tps_protect(tps, first, last, PROT_READ);
+	tps_copy(tps, offset, length, buffer, 0);
+	tps_protect(tps, first, last, PROT_NONE);
+
+	tps_unlock_pages(tps, first, last);
+	lock_release(&tps->lock);
+	return 0;
+}
+
+static int tps_area_write(tps_t tps, size_t offset, size_t length, char *buffer)
+{
+	size_t first, last, i;
+
+	first = offset / tps->page_size;
+	last = (offset + length - 1) / tps->page_size;
+	lock_acquire(&tps->lock);
+	tps_lock_pages(tps, first, last);
+
+	/* Copy on Write if necessary, only for the pages being written */
+	for (i = first; i <= last; i++) {
+		if (atomic_load(&tps->pages[i]->ref_count) > 1
+		    && tps_page_copy(tps, i)) {
+			tps_unlock_pages(tps, first, last);
+			lock_release(&tps->lock);
+			return -1;
+		}
+	}
+
+	/* Allow temporary write access */
+	tps_protect(tps, first, last, PROT_READ | PROT_WRITE);
+	tps_copy(tps, offset, length, buffer, 1);
+	tps_protect(tps, first, last, PROT_NONE);
+
+	tps_unlock_pages(tps, first, last);
+	lock_release(&tps->lock);
+	return 0;
+}
+
+/*
+ * Give the new @tps the memory of @cpy, pinned by the caller. The new tps will
+ * point to exisiting pages and increment their ref_count.
+ */
+static int tps_area_clone(tps_t tps, tps_t cpy)
+{
+	size_t i, npages;
+
+	lock_init(&tps->lock);
+	tps->page_size = cpy->page_size;
+	npages = tps_npages(tps);
+
+	tps->pages = (page_t*) malloc(npages * sizeof(page_t));
+	if (tps->pages == NULL) {
+		return -1;
+	}
+
+	/*
+	 * With the lock of @cpy, its owner is not amid a write, so that a
+	 * write spanning several pages is either entirely in the clone or not
+	 * at all, and keeps its references to the pages until the clone has
+	 * its own
+	 */
+	lock_acquire(&cpy->lock);
+	for (i = 0; i < npages; i++) {
+		tps->pages[i] = cpy->pages[i];
+		atomic_fetch_add(&tps->pages[i]->ref_count, 1);
+	}
+	lock_release(&cpy->lock);
+
+	return 0;
+}
+
+/*
+ * Whether the locked pages of a tps are a single run of memory, which the tps
+ * owns alone if @write
+ */
+static int tps_area_contiguous(tps_t tps, int write)
+{
+	size_t i;
+
+	for (i = 0; i < tps_npages(tps); i++) {
+		if (tps->pages[i]->ptr
+		    != tps->pages[0]->ptr + i * tps->page_size) {
+			return 0;
+		} else if (write
+			   && atomic_load(&tps->pages[i]->ref_count) > 1) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Give a tps whose pages are all locked its own copy of them, in a single
+ * mapping, locked in turn. The lock of the tps keeps threads cloning it away
+ * from the old pages and table while they are released. Return -1 in case of
+ * failure.
+ */
+static int tps_area_compact(tps_t tps)
+{
+	size_t i, npages = tps_npages(tps);
+	page_t *old_pages = tps->pages;
+	page_t *pages;
+
+	pages = (page_t*) malloc(npages * sizeof(page_t));
+	if (pages == NULL) {
+		return -1;
+	} else if (tps_pages_create(pages, npages, tps->page_size)) {
+		free(pages);
+		return -1;
+	}
+
+	/* Copy the pages, wherever they are, into the new mapping */
+	tps_protect(tps, 0, npages - 1, PROT_READ);
+	mprotect(pages[0]->ptr, npages * tps->page_size,
+		 PROT_READ | PROT_WRITE);
+	for (i = 0; i < npages; i++) {
+		lock_acquire(&pages[i]->lock);
+		memcpy(pages[i]->ptr, old_pages[i]->ptr, tps->page_size);
+	}
+	mprotect(pages[0]->ptr, npages * tps->page_size, PROT_NONE);
+	tps_protect(tps, 0, npages - 1, PROT_NONE);
+
+	/* Swap the page tables while the old pages are still locked */
+	tps->pages = pages;
+	for (i = 0; i < npages; i++) {
+		lock_release(&old_pages[i]->lock);
+	}
+	tps_release_pages(old_pages, npages, tps->page_size);
+	free(old_pages);
+
+	return 0;
+}
+
+/*
+ * Open the memory of a tps for a session, with the tps and all its pages locked
+ * until tps_area_end(). A session accesses the area through a single pointer,
+ * so pages scattered by copies on write, or shared with other threads if
+ * @write, are first gathered into a new mapping. Return NULL in case of
+ * failure.
+ */
+static char *tps_area_begin(tps_t tps, int write)
+{
+	size_t last = tps_npages(tps) - 1;
+
+	lock_acquire(&tps->lock);
+	tps_lock_pages(tps, 0, last);
+
+	if (!tps_area_contiguous(tps, write) && tps_area_compact(tps)) {
+		tps_unlock_pages(tps, 0, last);
+		lock_release(&tps->lock);
+		return NULL;
+	}
+
+	mprotect(tps->pages[0]->ptr, (last + 1) * tps->page_size,
+		 write ? PROT_READ | PROT_WRITE : PROT_READ);
+	return tps->pages[0]->ptr;
+}
+
+static void tps_area_end(tps_t tps)
+{
+	size_t last = tps_npages(tps) - 1;
+
+	mprotect(tps->pages[0]->ptr, (last + 1) * tps->page_size, PROT_NONE);
+	tps_unlock_pages(tps, 0, last);
+	lock_release(&tps->lock);
+}
+#else
+/* Create a file of @size bytes for a TPS area. Return NULL in case of failure */
+static struct tps_file *tps_file_create(size_t size)
+{
+	struct tps_file *file;
+
+	file = (struct tps_file*) malloc(sizeof(struct tps_file));
+	if (file == NULL) {
+		return NULL;
+	}
+
+	file->fd = memfd_create("tps", MFD_CLOEXEC);
+	if (file->fd == -1) {
+		free(file);
+		return NULL;
+	} else if (ftruncate(file->fd, size)) {
+		close(file->fd);
+		free(file);
+		return NULL;
+	}
+	atomic_init(&file->ref_count, 1);
+
+	return file;
+}
+
+/* Drop a reference to a file, closing it once no area maps it anymore */
+static void tps_file_put(struct tps_file *file)
+{
+	if (atomic_fetch_sub(&file->ref_count, 1) == 1) {
+		close(file->fd);
+		free(file);
+	}
+}
+
+/*
+ * Replace the mapping of a locked tps by a private mapping of @file, at the
+ * same address. Return -1 in case of failure.
+ */
+static int tps_remap(tps_t tps, struct tps_file *file)
+{
+	if (mmap(tps->ptr, tps->size, PROT_NONE, MAP_PRIVATE | MAP_FIXED,
+		 file->fd, 0) == MAP_FAILED) {
+		return -1;
+	}
+
+	if (tps->size >= TPS_HUGEPAGE_SIZE) {
+		madvise(tps->ptr, tps->size, MADV_HUGEPAGE);
+	}
+
+	return 0;
+}
+
+/*
+ * Map the memory of a new tps of @tps->size bytes, a new file of its own which
+ * it maps shared. Return -1 in case of failure.
+ */
+static int tps_area_create(tps_t tps)
+{
+	void *void_ptr;
+
+	tps->file = tps_file_create(tps->size);
+	if (tps->file == NULL) {
+		return -1;
+	}
+
+	/* Allocate memory and check for proper allocation */
+	void_ptr = tps_map(tps->size, MAP_SHARED, tps->file->fd);
+	if (void_ptr == MAP_FAILED) {
+		tps_file_put(tps->file);
+		return -1;
+	}
+
+	lock_init(&tps->lock);
+	tps->ptr    = (char*) void_ptr;
+	tps->shared = 1;
+	tps->dirty  = 0;
+
+	/* Let the fault handler recognize the new area */
+	if (tps_index_set(tps->ptr, tps->size, tps)) {
+		munmap(tps->ptr, tps->size);
+		tps_file_put(tps->file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Unmap memory, and drop the file if no other area maps it */
+static void tps_area_destroy(tps_t tps)
+{
+	tps_index_set(tps->ptr, tps->size, NULL);
+	munmap(tps->ptr, tps->size);
+	tps_file_put(tps->file);
+}
+
+static int tps_area_read(tps_t tps, size_t offset, size_t length, char *buffer)
+{
+	lock_acquire(&tps->lock);
+
+	/* Allow temporary read access */
+	mprotect(tps->ptr, tps->size, PROT_READ);
+	memcpy(buffer, tps->ptr + offset, length);
+	mprotect(tps->ptr, tps->size, PROT_NONE);
+
+	lock_release(&tps->lock);
+	return 0;
+}
+
+static int tps_area_write(tps_t tps, size_t offset, size_t length, char *buffer)
+{
+	lock_acquire(&tps->lock);
+
+	/*
+	 * Once cloned, the file must keep the content the clones map. The area
+	 * was the only one writing to it, and now maps it privately instead,
+	 * so that the kernel copies the pages written from now on.
+	 */
+	if (tps->shared && atomic_load(&tps->file->ref_count) > 1) {
+		if (tps_remap(tps, tps->file)) {
+			lock_release(&tps->lock);
+			return -1;
+		}
+		tps->shared = 0;
+	}
+
+	/* Allow temporary write access */
+	mprotect(tps->ptr, tps->size, PROT_READ | PROT_WRITE);
+	memcpy(tps->ptr + offset, buffer, length);
+	mprotect(tps->ptr, tps->size, PROT_NONE);
+	tps->dirty = !tps->shared;
+
+	lock_release(&tps->lock);
+	return 0;
+}
+
+/*
+ * Give @cpy a new file with its current content, when it was written since it
+ * mapped its file privately. Return -1 in case of failure.
+ */
+static int tps_area_refresh(tps_t cpy)
+{
+	struct tps_file *file;
+	size_t done = 0;
+	ssize_t ret;
+
+	file = tps_file_create(cpy->size);
+	if (file == NULL) {
+		return -1;
+	}
+
+	/* Temporary read access to copy the area into the file */
+	mprotect(cpy->ptr, cpy->size, PROT_READ);
+	while (done < cpy->size) {
+		ret = pwrite(file->fd, cpy->ptr + done, cpy->size - done, done);
+		if (ret <= 0) {
+			break;
+		}
+		done += ret;
+	}
+	mprotect(cpy->ptr, cpy->size, PROT_NONE);
+
+	if (done < cpy->size || tps_remap(cpy, file)) {
+		tps_file_put(file);
+		return -1;
+	}
+
+	tps_file_put(cpy->file);
+	cpy->file  = file;
+	cpy->dirty = 0;
+
+	return 0;
+}
+
+/*
+ * Give the new @tps the memory of @cpy, pinned by the caller: a private mapping
+ * of the same file, of which the kernel copies the pages written.
+ */
+static int tps_area_clone(tps_t tps, tps_t cpy)
+{
+	struct tps_file *file;
+	void *void_ptr;
+
+	lock_acquire(&cpy->lock);
+	if (cpy->dirty && tps_area_refresh(cpy)) {
+		lock_release(&cpy->lock);
+		return -1;
+	}
+	file = cpy->file;
+	atomic_fetch_add(&file->ref_count, 1);
+	lock_release(&cpy->lock);
+
+	void_ptr = tps_map(tps->size, MAP_PRIVATE, file->fd);
+	if (void_ptr == MAP_FAILED) {
+		tps_file_put(file);
+		return -1;
+	}
+
+	lock_init(&tps->lock);
+	tps->ptr    = (char*) void_ptr;
+	tps->file   = file;
+	tps->shared = 0;
+	tps->dirty  = 0;
+
+	/* Let the fault handler recognize the new area */
+	if (tps_index_set(tps->ptr, tps->size, tps)) {
+		munmap(tps->ptr, tps->size);
+		tps_file_put(file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Open the memory of a tps for a session, locked until tps_area_end(). Return
+ * NULL in case of failure.
+ */
+static char *tps_area_begin(tps_t tps, int write)
+{
+	lock_acquire(&tps->lock);
+
+	if (!write) {
+		mprotect(tps->ptr, tps->size, PROT_READ);
+		return tps->ptr;
+	}
+
+	/* Stop writing to a cloned file, as in tps_area_write() */
+	if (tps->shared && atomic_load(&tps->file->ref_count) > 1) {
+		if (tps_remap(tps, tps->file)) {
+			lock_release(&tps->lock);
+			return NULL;
+		}
+		tps->shared = 0;
+	}
+
+	mprotect(tps->ptr, tps->size, PROT_READ | PROT_WRITE);
+	tps->dirty = !tps->shared;
+	return tps->ptr;
+}
+
+static void tps_area_end(tps_t tps)
+{
+	mprotect(tps->ptr, tps->size, PROT_NONE);
+	lock_release(&tps->lock);
+}
+#endif
+
 int tps_create(void)
+{
+	return tps_create_sized(TPS_SIZE);
+}
+
+int tps_create_sized(size_t size)
 {	
 	tps_t new_tps = NULL;
-	void *void_ptr = NULL;
 	pthread_t tid;
 
+	/* Check if tps already created, or for invalid size */
+	if (tps_self != NULL) {
+		return -1;
+	} else if (size == 0 || size > SIZE_MAX - TPS_HUGEPAGE_SIZE) {
+		return -1;
+	}
+
 	tid = pthread_self();
 
-	enter_critical_section();
+	lock_acquire(&tps_lock);
 
-	/* Check if tps already created */
-	queue_iterate(tps_queue, find_tid, (void*)tid, &void_ptr);
-	if (void_ptr != NULL) {
-		exit_critical_section();
+	/* A previous thread with the same tid may have left its tps behind */
+	if (tps_table_find(tid) != NULL) {
+		lock_release(&tps_lock);
 		return -1;
 	}
 
-	/* Allocate memory and check for proper allocation */
-	void_ptr = mmap(NULL, TPS_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
-	if (void_ptr == MAP_FAILED) {
-		exit_critical_section();
+	if (tps_table_reserve()) {
+		lock_release(&tps_lock);
 		return -1;
 	}
-	
+
 	/* Create new tps struct */
-	new_tps       = (tps_t)  malloc(sizeof(struct tps));
-	new_tps->page = (page_t) malloc(sizeof(struct page));
+	new_tps = (tps_t) malloc(sizeof(struct tps));
+	if (new_tps == NULL) {
+		lock_release(&tps_lock);
+		return -1;
+	}
+	new_tps->tid  = tid;
+	new_tps->pins = 0;
+	new_tps->destroyed = 0;
 
-	new_tps->page->ptr       = (char*) void_ptr;
-	new_tps->page->ref_count = 1;
-	new_tps->tid             = tid;
+	/* Areas are made of whole pages */
+	new_tps->size = (size + TPS_SIZE - 1) & ~(size_t)(TPS_SIZE - 1);
 
-	tps_queue_enqueue_check(&tps_queue, (void*) new_tps);
+	if (tps_area_create(new_tps)) {
+		lock_release(&tps_lock);
+		free(new_tps);
+		return -1;
+	}
 
-	exit_critical_section();
+	tps_table_insert(new_tps);
+
+	lock_release(&tps_lock);
+
+	tps_self = new_tps;
 	return 0;
 }
 
 int tps_destroy(void)
 {
 	tps_t del_tps = NULL;
-	void *void_ptr = NULL;
-	pthread_t tid;
-
-	tid = pthread_self();
-
-	enter_critical_section();
 
 	/* Check if tid has allocated tps */
-	queue_iterate(tps_queue, find_tid, (void*)tid, (void**)&void_ptr);
-	if (void_ptr == NULL) {
-		exit_critical_section();
+	del_tps = tps_self;
+	if (del_tps == NULL) {
+		return -1;
+	} else if (tps_session != NULL) {
 		return -1;
 	}
 
-	del_tps = (tps_t)void_ptr;
+	lock_acquire(&tps_lock);
+	tps_table_remove(del_tps);
+	del_tps->destroyed = 1;
+	if (del_tps->pins > 0) {
+		/* The last thread cloning it will free it */
+		del_tps = NULL;
+	}
+	lock_release(&tps_lock);
 
-	/* 
-	 * Check page reference count
-	 * -If 1: Unmap memory, free struct data, and dequeue
-	 * -else: decrement ref_count
-	 */
-	if (del_tps->page->ref_count == 1) {
-		mprotect(del_tps->page->ptr, TPS_SIZE, PROT_READ | PROT_WRITE);
-		munmap(del_tps->page->ptr, TPS_SIZE);
-		free(del_tps->page);
+	tps_self = NULL;
+
+	if (del_tps != NULL) {
+		tps_area_destroy(del_tps);
 		free(del_tps);
-		tps_queue_delete_check(&tps_queue, (void*)del_tps);
-	} else {
-		del_tps->page->ref_count -= 1;
 	}
 
-	exit_critical_section();
 	return 0;
 }
 
 int tps_read(size_t offset, size_t length, char *buffer)
 {
 	tps_t access_tps = NULL;
-	void *void_ptr = NULL;
-	pthread_t tid;
-
-	tid = pthread_self();
-
-	enter_critical_section();
 
 	/* 
 	 * Check for:
@@ -221,43 +1195,33 @@ int tps_read(size_t offset, size_t length, char *buffer)
 	 * -out of bounds
 	 */
 	if (buffer == NULL) {
-		exit_critical_section();
-		return -1;
-	} else if (offset >= TPS_SIZE) {
-		exit_critical_section();
 		return -1;
-	} else if ((offset + length) > TPS_SIZE) {
-		exit_critical_section();
-		return -1;
-	} 
+	}
 
 	/* Check for tps for current tid */
-	queue_iterate(tps_queue, find_tid, (void*)tid, &void_ptr);
-	if ( void_ptr == NULL) {
-		exit_critical_section();
+	access_tps = tps_self;
+	if (access_tps == NULL) {
 		return -1;
+	} else if (offset >= access_tps->size) {
+		return -1;
+	} else if (length > access_tps->size - offset) {
+		return -1;
+	} else if (length == 0) {
+		return 0;
 	}
 
-	access_tps = (tps_t) void_ptr;
-
-	/* Allow temporary read access */
-	mprotect(access_tps->page->ptr, TPS_SIZE, PROT_READ);
-	memcpy(buffer, (void*)(access_tps->page->ptr + offset), length);
-	mprotect(access_tps->page->ptr, TPS_SIZE, PROT_NONE);
+	/* The memory is already open within a session */
+	if (tps_session != NULL) {
+		memcpy(buffer, tps_session + offset, length);
+		return 0;
+	}
 
-	exit_critical_section();
-	return 0;
+	return tps_area_read(access_tps, offset, length, buffer);
 }
 
 int tps_write(size_t offset, size_t length, char *buffer)
 {
 	tps_t access_tps = NULL;
-	void *void_ptr = NULL;
-	pthread_t tid;
-
-	tid = pthread_self();
-
-	enter_critical_section();
 
 	/* 
 	 * Check for:
@@ -265,109 +1229,155 @@ int tps_write(size_t offset, size_t length, char *buffer)
 	 * -out of bounds
 	 */
 	if (buffer == NULL) {
-		exit_critical_section();
 		return -1;
-	} else if (offset >= TPS_SIZE) {
-		exit_critical_section();
-		return -1;
-	} else if ((offset + length) > TPS_SIZE) {
-		exit_critical_section();
-		return -1;
-	} 
+	}
 
 	/* Check for tps for current tid */
-	queue_iterate(tps_queue, find_tid, (void*)tid, (void**)&void_ptr);
-	if (void_ptr == NULL) {
-		exit_critical_section();
+	access_tps = tps_self;
+	if (access_tps == NULL) {
+		return -1;
+	} else if (offset >= access_tps->size) {
+		return -1;
+	} else if (length > access_tps->size - offset) {
 		return -1;
+	} else if (length == 0) {
+		return 0;
 	}
 
-	access_tps = (tps_t) void_ptr;
-
-	/* Copy on Write if necessary */
-	if (access_tps->page->ref_count == 1) {
-		/* Allow temporary write access */
-		mprotect(access_tps->page->ptr, TPS_SIZE, PROT_READ | PROT_WRITE);
-		memcpy((void*)(access_tps->page->ptr + offset), buffer, length);
-		mprotect(access_tps->page->ptr, TPS_SIZE, PROT_NONE);
-	} else {
-		page_t old_page;
-
-		/* Save shared page into variable and decrement ref_count */
-		old_page = access_tps->page;
-		old_page->ref_count -= 1;
-
-		/* Allocate memory and check for proper allocation */
-		void_ptr = mmap(NULL, TPS_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
-		if (void_ptr == MAP_FAILED) {
-			exit_critical_section();
+	/* The memory is already open within a session, if for writing */
+	if (tps_session != NULL) {
+		if (!(tps_session_mode & TPS_WRITE)) {
 			return -1;
 		}
-
-		/* Create new page */
-		access_tps->page = (page_t) malloc(sizeof(struct page));
-		access_tps->page->ref_count = 1;
-		access_tps->page->ptr       = (char*) void_ptr;
-		access_tps->tid             = tid;
-
-		/* Unprotect memory */
-		mprotect(access_tps->page->ptr, TPS_SIZE, PROT_READ | PROT_WRITE);
-		mprotect(old_page->ptr, TPS_SIZE, PROT_READ);
-
-		/* Copy memory and write buffer */
-		memcpy((access_tps->page->ptr), (old_page->ptr), TPS_SIZE);
-		memcpy((void*)(access_tps->page->ptr + offset), buffer, length);
-
-		/* Protect memory */
-		mprotect(access_tps->page->ptr, TPS_SIZE, PROT_NONE);
-		mprotect(old_page->ptr, TPS_SIZE, PROT_NONE);
+		memcpy(tps_session + offset, buffer, length);
+		return 0;
 	}
 
-	exit_critical_section();
-	return 0;
+	return tps_area_write(access_tps, offset, length, buffer);
 }
 
 int tps_clone(pthread_t tid)
 {
-	void *void_ptr = NULL;
 	tps_t cpy_tps = NULL;
 	tps_t new_tps = NULL;
+	tps_t del_tps = NULL;
 	pthread_t current_tid;
 	
+	/* Check if current tid already has tps */
+	if (tps_self != NULL) {
+		return -1;
+	}
+
 	current_tid = pthread_self();
 
-	enter_critical_section();
+	lock_acquire(&tps_lock);
 
-	/* Check if current tid already has tps */
-	queue_iterate(tps_queue, find_tid, (void*)current_tid, (void**)&void_ptr);
-	if (void_ptr != NULL) {
-		exit_critical_section();
+	/* A previous thread with the same tid may have left its tps behind */
+	if (tps_table_find(current_tid) != NULL) {
+		lock_release(&tps_lock);
 		return -1;
 	} 
 
 	/* Check if passed tid has tps */
-	void_ptr = NULL;
-	queue_iterate(tps_queue, find_tid, (void*)tid, (void**)&void_ptr);
-	if (void_ptr == NULL) {
-		exit_critical_section();
+	cpy_tps = tps_table_find(tid);
+	if (cpy_tps == NULL) {
+		lock_release(&tps_lock);
 		return -1;
 	}
-	
-	/* Get the tps clone */
-	cpy_tps = (tps_t) void_ptr;
+
+	/*
+	 * Pin the tps to clone and wait for its memory without tps_lock: its
+	 * owner may hold it for a whole session
+	 */
+	cpy_tps->pins++;
+	lock_release(&tps_lock);
 
 	/* Create new tps*/
 	new_tps = (tps_t) malloc(sizeof(struct tps));
-	new_tps->tid = current_tid;
+	if (new_tps != NULL) {
+		new_tps->tid = current_tid;
+		new_tps->size = cpy_tps->size;
+		new_tps->pins = 0;
+		new_tps->destroyed = 0;
+
+		if (tps_area_clone(new_tps, cpy_tps)) {
+			free(new_tps);
+			new_tps = NULL;
+		}
+	}
 
-	/* New tps will point to exisiting page struct and increment ref_count */
-	new_tps->page = cpy_tps->page;
-	new_tps->page->ref_count += 1;
+	lock_acquire(&tps_lock);
 
-	/* Enqueue the new tps */
-	tps_queue_enqueue_check(&tps_queue, (void*) new_tps);
+	/* Index the new tps */
+	if (new_tps != NULL) {
+		if (tps_table_reserve() == 0) {
+			tps_table_insert(new_tps);
+			tps_self = new_tps;
+		} else {
+			del_tps = new_tps;
+			new_tps = NULL;
+		}
+	}
 
-	exit_critical_section();
-	return 0;
+	/* Unpin the cloned tps, which may have been destroyed meanwhile */
+	if (--cpy_tps->pins > 0 || !cpy_tps->destroyed) {
+		cpy_tps = NULL;
+	}
+
+	lock_release(&tps_lock);
+
+	if (del_tps != NULL) {
+		tps_area_destroy(del_tps);
+		free(del_tps);
+	}
+	if (cpy_tps != NULL) {
+		tps_area_destroy(cpy_tps);
+		free(cpy_tps);
+	}
+
+	return new_tps != NULL ? 0 : -1;
+}
+
+void *tps_begin(int mode)
+{
+	tps_t access_tps = NULL;
+	char *ptr;
+
+	/* 
+	 * Check for:
+	 * -invalid mode
+	 * -session already open
+	 */
+	if (mode != TPS_READ && mode != (TPS_READ | TPS_WRITE)) {
+		return NULL;
+	} else if (tps_session != NULL) {
+		return NULL;
+	}
+
+	/* Check for tps for current tid */
+	access_tps = tps_self;
+	if (access_tps == NULL) {
+		return NULL;
+	}
+
+	ptr = tps_area_begin(access_tps, mode & TPS_WRITE);
+	if (ptr == NULL) {
+		return NULL;
+	}
+
+	tps_session = ptr;
+	tps_session_mode = mode;
+	return ptr;
 }
 
+int tps_end(void)
+{
+	if (tps_session == NULL) {
+		return -1;
+	}
+
+	tps_area_end(tps_self);
+	tps_session = NULL;
+
+	return 0;
+}
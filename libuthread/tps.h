@@ -6,10 +6,15 @@
 #include <sys/types.h>
 
 /*
- * Size of a TPS area in bytes
+ * Size of a TPS area in bytes, as created by tps_create(). Areas created by
+ * tps_create_sized() are a multiple of it.
  */
 #define TPS_SIZE 4096
 
+/* Access modes of a TPS session, see tps_begin() */
+#define TPS_READ	0x1
+#define TPS_WRITE	0x2
+
 /*
  * tps_init - Initialize TPS
  * @segv - Activate segfault handler
@@ -35,6 +40,20 @@ int tps_init(int segv);
  */
 int tps_create(void);
 
+/*
+ * tps_create_sized - Create TPS of a given size
+ * @size: Size of the TPS area in bytes
+ *
+ * Create a TPS area of @size bytes, rounded up to a multiple of TPS_SIZE, and
+ * associate it to the current thread. Areas of 2 MiB or more are aligned so
+ * that the kernel can back them with transparent huge pages.
+ *
+ * Return: -1 if current thread already has a TPS, if @size is 0, or in case
+ * of failure during the creation (e.g. memory allocation). 0 if the TPS area
+ * was successfully created.
+ */
+int tps_create_sized(size_t size);
+
 /*
  * tps_destroy - Destroy TPS
  *
@@ -52,7 +71,8 @@ int tps_destroy(void);
  * @buffer: Data buffer receiving the read data
  *
  * Read @length bytes of data from the current thread's TPS at byte offset
- * @offset into data buffer @buffer.
+ * @offset into data buffer @buffer. The whole range must be within the TPS
+ * area, of TPS_SIZE bytes or as given to tps_create_sized().
  *
  * Return: -1 if current thread doesn't have a TPS, or if the reading operation
  * is out of bound, or if @buffer is NULL, or in case of internal failure. 0 if
@@ -67,7 +87,7 @@ int tps_read(size_t offset, size_t length, char *buffer);
  * @buffer: Data buffer holding the data to be written
  *
  * Write @length bytes located in data buffer @buffer into the current thread's
- * TPS at byte offset @offset.
+ * TPS at byte offset @offset. The whole range must be within the TPS area.
  *
  * If the current thread's TPS shares a memory page with another thread's TPS,
  * this should trigger a copy-on-write operation before the actual write occurs.
@@ -84,11 +104,47 @@ int tps_write(size_t offset, size_t length, char *buffer);
  *
  * Clone thread @tid's TPS. In the first phase, the cloned TPS's content should
  * copied directly. In the last phase, the new TPS should not copy the cloned
- * TPS's content but should refer to the same memory page.
+ * TPS's content but should refer to the same memory page. The new TPS has the
+ * same size as thread @tid's.
  *
  * Return: -1 if thread @tid doesn't have a TPS, or if current thread already
  * has a TPS, or in case of failure. 0 is TPS was successfully cloned.
  */
 int tps_clone(pthread_t tid);
 
+/*
+ * tps_begin - Begin TPS session
+ * @mode: TPS_READ, or TPS_READ | TPS_WRITE
+ *
+ * Open the current thread's TPS for a batch of accesses, which is only
+ * unprotected once for the whole session instead of on every tps_read() and
+ * tps_write(). The returned pointer gives direct access to the whole area,
+ * read-only unless @mode includes TPS_WRITE, until tps_end(); it can be
+ * assigned to a pointer to whatever structure the TPS holds. tps_read(), and
+ * tps_write() with TPS_WRITE, keep working within the session.
+ *
+ * A session holds the TPS like a lock: threads sharing memory with it, or
+ * cloning it, wait until it ends, without holding up any other TPS operation.
+ * A writing session performs the pending copy-on-write of the whole area when
+ * it begins. The current thread can neither begin another session nor destroy
+ * its TPS before tps_end().
+ *
+ * Return: NULL if current thread doesn't have a TPS, if it already has a
+ * session open, if @mode is neither TPS_READ nor TPS_READ | TPS_WRITE (there
+ * are no write-only sessions), or in case of failure. The address of the
+ * TPS area otherwise.
+ */
+void *tps_begin(int mode);
+
+/*
+ * tps_end - End TPS session
+ *
+ * End the session opened by tps_begin(), protecting the TPS area again. The
+ * pointer returned by tps_begin() must no longer be used.
+ *
+ * Return: -1 if current thread doesn't have a session open. 0 if the session
+ * was successfully ended.
+ */
+int tps_end(void);
+
 #endif /* _TPS_H */
@@ -0,0 +1,209 @@
+/*
+ * Barrier and latch test
+ *
+ * A number of threads (8 by default) go through a number of phases, each
+ * thread recording its progress in a shared table. After the barrier at the
+ * end of each phase, every thread checks that all the other threads completed
+ * the phase, and that exactly one thread got BARRIER_SERIAL. The phases are
+ * synchronized either with semaphores, with one critical section per thread
+ * and per phase as in a hand-rolled barrier, or with a barrier, with and
+ * without BARRIER_TREE. The test reports the number of phases per second of
+ * each version.
+ *
+ * A latch, counted down by every thread once it is done, lets the main thread
+ * know when all the threads completed.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <barrier.h>
+#include <latch.h>
+#include <sem.h>
+
+#define NTHREADS	8
+#define MAXCOUNT	2000
+#define MAXTHREADS	64
+
+struct test {
+	size_t nthreads, maxcount;
+	barrier_t barrier;
+	latch_t done;
+
+	/* Semaphore barrier */
+	sem_t mutex, turnstile1, turnstile2;
+	size_t arrived;
+
+	size_t progress[MAXTHREADS];
+	atomic_int serial;
+};
+
+struct worker {
+	struct test *t;
+	size_t id;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reusable barrier made of semaphores: two turnstiles, opened by the last */
+static void sem_barrier(struct test *t)
+{
+	size_t i;
+
+	sem_down(t->mutex);
+	if (++t->arrived == t->nthreads) {
+		for (i = 0; i < t->nthreads; i++) {
+			sem_up(t->turnstile1);
+		}
+	}
+	sem_up(t->mutex);
+	sem_down(t->turnstile1);
+
+	sem_down(t->mutex);
+	if (--t->arrived == 0) {
+		for (i = 0; i < t->nthreads; i++) {
+			sem_up(t->turnstile2);
+		}
+	}
+	sem_up(t->mutex);
+	sem_down(t->turnstile2);
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = (struct worker*)arg;
+	struct test *t = w->t;
+	size_t phase, i;
+
+	for (phase = 1; phase <= t->maxcount; phase++) {
+		t->progress[w->id] = phase;
+
+		if (t->barrier == NULL) {
+			sem_barrier(t);
+		} else if (barrier_wait(t->barrier) == BARRIER_SERIAL) {
+			atomic_fetch_add(&t->serial, 1);
+		}
+
+		for (i = 0; i < t->nthreads; i++) {
+			assert(t->progress[i] >= phase);
+		}
+
+		/* Nobody may start the next phase before everybody checked */
+		if (t->barrier == NULL) {
+			sem_barrier(t);
+		} else {
+			barrier_wait(t->barrier);
+		}
+	}
+
+	latch_count_down(t->done, 1);
+
+	return NULL;
+}
+
+static void run(const char *name, int barrier, int flags, size_t nthreads,
+		size_t maxcount)
+{
+	struct worker w[MAXTHREADS];
+	pthread_t tid[MAXTHREADS];
+	struct test t = { 0 };
+	double start, elapsed;
+	size_t i;
+
+	t.nthreads = nthreads;
+	t.maxcount = maxcount;
+	if (barrier) {
+		t.barrier = barrier_create(nthreads, flags);
+	} else {
+		t.mutex = sem_create(1);
+		t.turnstile1 = sem_create(0);
+		t.turnstile2 = sem_create(0);
+	}
+	t.done = latch_create(nthreads);
+	atomic_init(&t.serial, 0);
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		w[i].t = &t;
+		w[i].id = i;
+		pthread_create(&tid[i], NULL, worker, &w[i]);
+	}
+
+	latch_wait(t.done);
+	elapsed = now() - start;
+	assert(latch_trywait(t.done) == 0);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tid[i], NULL);
+	}
+
+	if (barrier) {
+		assert((size_t)atomic_load(&t.serial) == maxcount);
+		assert(barrier_destroy(t.barrier) == 0);
+	} else {
+		sem_destroy(t.mutex);
+		sem_destroy(t.turnstile1);
+		sem_destroy(t.turnstile2);
+	}
+	assert(latch_destroy(t.done) == 0);
+
+	printf("%-8s %3zu threads %10.0f phases/s\n", name, nthreads,
+	       maxcount / elapsed);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t nthreads = NTHREADS;
+	size_t maxcount = MAXCOUNT;
+	latch_t latch;
+
+	if (argc > 1)
+		nthreads = get_argv(argv[1]);
+	if (argc > 2)
+		maxcount = get_argv(argv[2]);
+
+	if (nthreads < 1 || nthreads > MAXTHREADS) {
+		fprintf(stderr, "Number of threads must be in [1, %d]\n",
+			MAXTHREADS);
+		return 1;
+	}
+
+	run("sem", 0, 0, nthreads, maxcount);
+	run("barrier", 1, 0, nthreads, maxcount);
+	run("tree", 1, BARRIER_TREE, nthreads, maxcount);
+
+	/* Latch corner cases */
+	latch = latch_create(2);
+	assert(latch_trywait(latch) == -1);
+	assert(latch_count_down(latch, 3) == -1);
+	assert(latch_count_down(latch, 2) == 0);
+	assert(latch_wait(latch) == 0);
+	assert(latch_count_down(latch, 1) == -1);
+	assert(latch_destroy(latch) == 0);
+
+	assert(barrier_create(0, 0) == NULL);
+	assert(barrier_wait(NULL) == -1);
+
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Channel benchmark
+ *
+ * A number of producers (2 by default) send values to as many consumers
+ * through a bounded buffer, which is either a ring guarded by three semaphores
+ * as in sem_buffer, or a channel used one item at a time, or a channel used
+ * in batches. The test reports the throughput of each version.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <chan.h>
+#include <sem.h>
+
+#define NTHREADS	2
+#define MAXCOUNT	100000
+#define MAXTHREADS	32
+#define BUFFER_SIZE	64
+#define BATCH_SIZE	16
+
+enum mode {
+	MODE_SEM,
+	MODE_CHAN,
+	MODE_BATCH,
+};
+
+struct bench {
+	enum mode mode;
+	size_t maxcount;
+
+	/* Semaphore version */
+	struct semaphore empty;
+	struct semaphore full;
+	struct semaphore mutex;
+	size_t head, tail;
+	void *buffer[BUFFER_SIZE];
+
+	/* Channel versions */
+	chan_t chan;
+
+	/* Checksum of the received values */
+	uintptr_t sum;
+	pthread_mutex_t sum_mutex;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sem_send(struct bench *b, void *item)
+{
+	sem_down(&b->full);
+	sem_down(&b->mutex);
+	b->buffer[b->head] = item;
+	b->head = (b->head + 1) % BUFFER_SIZE;
+	sem_up(&b->mutex);
+	sem_up(&b->empty);
+}
+
+static void *sem_recv(struct bench *b)
+{
+	void *item;
+
+	sem_down(&b->empty);
+	sem_down(&b->mutex);
+	item = b->buffer[b->tail];
+	b->tail = (b->tail + 1) % BUFFER_SIZE;
+	sem_up(&b->mutex);
+	sem_up(&b->full);
+
+	return item;
+}
+
+static void *producer(void *arg)
+{
+	struct bench *b = (struct bench*)arg;
+	void *items[BATCH_SIZE];
+	size_t i, n;
+
+	for (i = 1; i <= b->maxcount; i += n) {
+		n = 1;
+		if (b->mode == MODE_SEM) {
+			sem_send(b, (void*)i);
+		} else if (b->mode == MODE_CHAN) {
+			chan_send(b->chan, (void*)i);
+		} else {
+			for (n = 0; n < BATCH_SIZE && i + n <= b->maxcount; n++) {
+				items[n] = (void*)(i + n);
+			}
+			chan_send_n(b->chan, items, n);
+		}
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct bench *b = (struct bench*)arg;
+	void *items[BATCH_SIZE];
+	uintptr_t sum = 0;
+	int i, n;
+
+	while (1) {
+		if (b->mode == MODE_SEM) {
+			items[0] = sem_recv(b);
+			n = 1;
+		} else if (b->mode == MODE_CHAN) {
+			chan_recv(b->chan, &items[0]);
+			n = 1;
+		} else {
+			n = chan_recv_n(b->chan, items, BATCH_SIZE);
+		}
+
+		for (i = 0; i < n; i++) {
+			/* End of the test, leave other consumers their NULL */
+			if (items[i] == NULL) {
+				while (++i < n) {
+					chan_send(b->chan, NULL);
+				}
+				pthread_mutex_lock(&b->sum_mutex);
+				b->sum += sum;
+				pthread_mutex_unlock(&b->sum_mutex);
+				return NULL;
+			}
+			sum += (uintptr_t)items[i];
+		}
+	}
+}
+
+static void run(const char *name, enum mode mode, size_t nthreads,
+		size_t maxcount)
+{
+	pthread_t prod[MAXTHREADS], cons[MAXTHREADS];
+	struct bench b;
+	double start, elapsed;
+	size_t i;
+
+	b.mode = mode;
+	b.maxcount = maxcount;
+	sem_init(&b.empty, 0);
+	sem_init(&b.full, BUFFER_SIZE);
+	sem_init(&b.mutex, 1);
+	b.head = b.tail = 0;
+	b.chan = chan_create(BUFFER_SIZE);
+	b.sum = 0;
+	pthread_mutex_init(&b.sum_mutex, NULL);
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		pthread_create(&prod[i], NULL, producer, &b);
+		pthread_create(&cons[i], NULL, consumer, &b);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(prod[i], NULL);
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (mode == MODE_SEM) {
+			sem_send(&b, NULL);
+		} else {
+			chan_send(b.chan, NULL);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(cons[i], NULL);
+	}
+	elapsed = now() - start;
+
+	/* Every producer sent 1 + 2 + ... + maxcount */
+	assert(b.sum == nthreads * maxcount * (maxcount + 1) / 2);
+
+	printf("%-8s %10.0f items/s\n", name, nthreads * maxcount / elapsed);
+
+	sem_fini(&b.empty);
+	sem_fini(&b.full);
+	sem_fini(&b.mutex);
+	chan_destroy(b.chan);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t nthreads = NTHREADS;
+	size_t maxcount = MAXCOUNT;
+
+	if (argc > 1)
+		nthreads = get_argv(argv[1]);
+	if (argc > 2)
+		maxcount = get_argv(argv[2]);
+
+	if (nthreads < 1 || nthreads > MAXTHREADS) {
+		fprintf(stderr, "Number of threads must be in [1, %d]\n",
+			MAXTHREADS);
+		return 1;
+	}
+
+	printf("%zu producers, %zu consumers, %zu items each\n", nthreads,
+	       nthreads, maxcount);
+	run("sem", MODE_SEM, nthreads, maxcount);
+	run("chan", MODE_CHAN, nthreads, maxcount);
+	run("batch", MODE_BATCH, nthreads, maxcount);
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Channel producer/consumer test
+ *
+ * Same as sem_buffer, but the buffer is a channel: several producers send
+ * values in batches of random size, with chan_send_n() or one at a time, while
+ * several consumers receive whatever is available with chan_recv_n(). Each
+ * consumer checks that the values of a given producer arrive in order, and
+ * the main thread checks that every value was received exactly once. Finally,
+ * the channel must not be destroyed while a receiver is blocked on it, which
+ * chan_getvalue() reports.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chan.h>
+
+#define BUFFER_SIZE	16
+#define MAXCOUNT	1000
+#define NPRODUCERS	3
+#define NCONSUMERS	3
+
+/* A value is made of the producer's id and a sequence number */
+#define VALUE(id, seq)	((void*)(uintptr_t)(((seq) << 8) | (id)))
+#define VALUE_ID(v)	((uintptr_t)(v) & 0xff)
+#define VALUE_SEQ(v)	((uintptr_t)(v) >> 8)
+
+struct test {
+	chan_t chan;
+	size_t maxcount;
+	size_t received[NPRODUCERS];
+	pthread_mutex_t mutex;
+};
+
+struct producer {
+	struct test *t;
+	unsigned int id, seed;
+};
+
+#define clamp(x, y) (((x) <= (y)) ? (x) : (y))
+
+static void *consumer(void* arg)
+{
+	struct test *t = (struct test*)arg;
+	size_t last[NPRODUCERS] = { 0 };
+	void *items[BUFFER_SIZE];
+	int i, n;
+
+	while (1) {
+		n = chan_recv_n(t->chan, items, BUFFER_SIZE);
+		assert(n >= 1 && n <= BUFFER_SIZE);
+
+		for (i = 0; i < n; i++) {
+			uintptr_t id = VALUE_ID(items[i]);
+
+			/* End of the test, leave other consumers their NULL */
+			if (items[i] == NULL) {
+				while (++i < n) {
+					chan_send(t->chan, NULL);
+				}
+				return NULL;
+			}
+
+			assert(id < NPRODUCERS);
+			assert(VALUE_SEQ(items[i]) > last[id]);
+			last[id] = VALUE_SEQ(items[i]);
+
+			pthread_mutex_lock(&t->mutex);
+			t->received[id]++;
+			pthread_mutex_unlock(&t->mutex);
+		}
+	}
+}
+
+static void *receiver(void *arg)
+{
+	void *item;
+
+	assert(chan_recv((chan_t)arg, &item) == 0);
+	assert(item != NULL);
+
+	return NULL;
+}
+
+static void *producer(void* arg)
+{
+	struct producer *p = (struct producer*)arg;
+	void *items[BUFFER_SIZE * 2];
+	size_t i, count = 0;
+
+	while (count < p->t->maxcount) {
+		size_t n = rand_r(&p->seed) % (BUFFER_SIZE * 2) + 1;
+
+		n = clamp(n, p->t->maxcount - count);
+		if (n == 1) {
+			/* Also exercise the single item functions */
+			count++;
+			if (chan_trysend(p->t->chan, VALUE(p->id, count))) {
+				chan_send(p->t->chan, VALUE(p->id, count));
+			}
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			items[i] = VALUE(p->id, ++count);
+		}
+		chan_send_n(p->t->chan, items, n);
+	}
+
+	return NULL;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct producer p[NPRODUCERS];
+	pthread_t prod[NPRODUCERS], cons[NCONSUMERS];
+	struct test t;
+	void *item;
+	size_t i;
+	int value;
+
+	t.maxcount = MAXCOUNT;
+	if (argc > 1)
+		t.maxcount = get_argv(argv[1]);
+
+	t.chan = chan_create(BUFFER_SIZE);
+	pthread_mutex_init(&t.mutex, NULL);
+
+	/* Nothing to receive yet */
+	assert(chan_tryrecv(t.chan, &item) == -1);
+
+	for (i = 0; i < NPRODUCERS; i++) {
+		t.received[i] = 0;
+		p[i].t = &t;
+		p[i].id = i;
+		p[i].seed = i + 1;
+		pthread_create(&prod[i], NULL, producer, &p[i]);
+	}
+	for (i = 0; i < NCONSUMERS; i++) {
+		pthread_create(&cons[i], NULL, consumer, &t);
+	}
+
+	for (i = 0; i < NPRODUCERS; i++) {
+		pthread_join(prod[i], NULL);
+	}
+	for (i = 0; i < NCONSUMERS; i++) {
+		chan_send(t.chan, NULL);
+	}
+	for (i = 0; i < NCONSUMERS; i++) {
+		pthread_join(cons[i], NULL);
+	}
+
+	for (i = 0; i < NPRODUCERS; i++) {
+		printf("Received %zu values from producer %zu\n", t.received[i], i);
+		assert(t.received[i] == t.maxcount);
+	}
+
+	/* Every consumer took exactly one NULL */
+	assert(chan_tryrecv(t.chan, &item) == -1);
+
+	/* Not destroyed, and still usable, while a receiver is blocked */
+	pthread_create(&cons[0], NULL, receiver, t.chan);
+	do {
+		assert(chan_getvalue(t.chan, &value) == 0);
+		sched_yield();
+	} while (value >= 0);
+	assert(chan_destroy(t.chan) == -1);
+	assert(chan_send(t.chan, &t) == 0);
+	pthread_join(cons[0], NULL);
+
+	assert(chan_create(0) == NULL);
+	assert(chan_send(NULL, NULL) == -1);
+	assert(chan_destroy(t.chan) == 0);
+
+	return 0;
+}
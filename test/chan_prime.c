@@ -0,0 +1,156 @@
+/*
+ * Channel sieve test for finding prime numbers
+ *
+ * Same as sem_prime, but each stage of the pipeline is connected to the next
+ * one by a channel instead of a hand-rolled slot guarded by two semaphores.
+ *
+ * A producer thread (source) creates numbers and inserts them into a pipeline,
+ * a consumer thread (sink) gets prime numbers from the end of the pipeline. The
+ * pipeline consists of filtering thread, added dynamically each time a new
+ * prime number is found and which filters out subsequent numbers that are
+ * multiples of that prime.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chan.h>
+
+#define MAXPRIME 1000
+#define CHAN_SIZE 16
+
+#define TO_ITEM(v)	((void*)(intptr_t)(v))
+#define FROM_ITEM(i)	((int)(intptr_t)(i))
+
+struct filter {
+	chan_t left;
+	chan_t right;
+	int prime;
+	pthread_t tid;
+	struct filter *next;
+};
+
+static unsigned int max = MAXPRIME;
+
+/* Producer thread: produces all numbers, from 2 to max */
+static void *source(void *arg)
+{
+	chan_t c = (chan_t) arg;
+	size_t i;
+
+	for (i = 2; i <= max; i++) {
+		chan_send(c, TO_ITEM(i));
+	}
+
+	/* mark completion */
+	chan_send(c, TO_ITEM(-1));
+
+	return NULL;
+}
+
+/* Filter thread */
+static void *filter(void *arg)
+{
+	struct filter *f = (struct filter*) arg;
+	void *item;
+	int value;
+
+	while (1) {
+		chan_recv(f->left, &item);
+		value = FROM_ITEM(item);
+		if ((value == -1) || (value % f->prime != 0)) {
+			chan_send(f->right, item);
+		}
+		if (value == -1)
+			break;
+	}
+
+	return NULL;
+}
+
+/* Consumer thread */
+static void *sink(void *arg)
+{
+	chan_t init_p, p;
+	void *item;
+	int value;
+	pthread_t tid;
+	struct filter *f_head = NULL;
+
+	init_p = chan_create(CHAN_SIZE);
+
+	p = init_p;
+
+	pthread_create(&tid, NULL, source, p);
+
+	while (1) {
+		struct filter *f;
+
+		chan_recv(p, &item);
+		value = FROM_ITEM(item);
+
+		if (value == -1)
+			break;
+
+		printf("%d is prime.\n", value);
+
+		f = malloc(sizeof(*f));
+		f->left = p;
+		f->prime = value;
+		f->next = NULL;
+
+		p = chan_create(CHAN_SIZE);
+
+		f->right = p;
+
+		pthread_create(&f->tid, NULL, filter, f);
+
+		if (f_head)
+			f->next = f_head;
+		f_head = f;
+	}
+
+	pthread_join(tid, NULL);
+
+	while (f_head) {
+		struct filter *old = f_head;
+
+		pthread_join(f_head->tid, NULL);
+		chan_destroy(f_head->right);
+		f_head = f_head->next;
+		free(old);
+	}
+
+	/* The first filter reads from the source's channel until it exits */
+	chan_destroy(init_p);
+
+	return NULL;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t tid;
+
+	if (argc > 1)
+		max = get_argv(argv[1]);
+
+	pthread_create(&tid, NULL, sink, NULL);
+	pthread_join(tid, NULL);
+
+	return 0;
+}
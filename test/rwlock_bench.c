@@ -0,0 +1,189 @@
+/*
+ * Reader-writer lock benchmark
+ *
+ * A number of threads repeatedly read a small shared table, and sometimes
+ * (1% of the time by default) update it. The table is either protected by a
+ * semaphore initialized to 1, i.e. used as a mutex, or by a reader-writer
+ * lock, with and without writer preference. Readers check that they never see
+ * a partially updated table, and the test reports the throughput of each
+ * version.
+ *
+ * Unless a number of threads is given, the test is run with 1 to 64 threads.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <rwlock.h>
+#include <sem.h>
+
+#define MAXCOUNT	10000
+#define MAXTHREADS	64
+#define WRITE_PERCENT	1
+#define TABLE_SIZE	8
+
+struct bench {
+	sem_t mutex;
+	rwlock_t rwlock;
+	size_t maxcount;
+	unsigned int write_percent;
+	unsigned int table[TABLE_SIZE];
+	size_t writes;
+};
+
+struct worker {
+	struct bench *b;
+	unsigned int seed;
+	size_t writes;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void table_read(struct bench *b)
+{
+	size_t i;
+
+	for (i = 1; i < TABLE_SIZE; i++) {
+		assert(b->table[i] == b->table[0]);
+	}
+}
+
+static void table_write(struct bench *b)
+{
+	size_t i;
+
+	for (i = 0; i < TABLE_SIZE; i++) {
+		b->table[i]++;
+	}
+	b->writes++;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = (struct worker*)arg;
+	struct bench *b = w->b;
+	size_t i;
+
+	for (i = 0; i < b->maxcount; i++) {
+		int write = (unsigned int)rand_r(&w->seed) % 100 < b->write_percent;
+
+		if (b->mutex) {
+			sem_down(b->mutex);
+			if (write) {
+				table_write(b);
+			} else {
+				table_read(b);
+			}
+			sem_up(b->mutex);
+		} else if (write) {
+			rwlock_wrlock(b->rwlock);
+			table_write(b);
+			rwlock_wrunlock(b->rwlock);
+		} else {
+			rwlock_rdlock(b->rwlock);
+			table_read(b);
+			rwlock_rdunlock(b->rwlock);
+		}
+
+		w->writes += write;
+	}
+
+	return NULL;
+}
+
+static void run(const char *name, int rwlock, int flags, size_t nthreads,
+		size_t maxcount, unsigned int write_percent)
+{
+	struct worker w[MAXTHREADS];
+	pthread_t tid[MAXTHREADS];
+	struct bench b = { 0 };
+	double start, elapsed;
+	size_t i, writes = 0;
+
+	if (rwlock) {
+		b.rwlock = rwlock_create(flags);
+	} else {
+		b.mutex = sem_create(1);
+	}
+	b.maxcount = maxcount;
+	b.write_percent = write_percent;
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		w[i].b = &b;
+		w[i].seed = i + 1;
+		w[i].writes = 0;
+		pthread_create(&tid[i], NULL, worker, &w[i]);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tid[i], NULL);
+		writes += w[i].writes;
+	}
+	elapsed = now() - start;
+
+	assert(b.writes == writes);
+	assert(b.table[0] == writes);
+
+	printf("%-8s %3zu threads %10.0f ops/s\n", name, nthreads,
+	       nthreads * maxcount / elapsed);
+
+	if (rwlock) {
+		assert(rwlock_destroy(b.rwlock) == 0);
+	} else {
+		assert(sem_destroy(b.mutex) == 0);
+	}
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t nthreads = 0, maxcount = MAXCOUNT, n;
+	unsigned int write_percent = WRITE_PERCENT;
+
+	if (argc > 1)
+		nthreads = get_argv(argv[1]);
+	if (argc > 2)
+		maxcount = get_argv(argv[2]);
+	if (argc > 3)
+		write_percent = get_argv(argv[3]);
+
+	if (nthreads > MAXTHREADS || write_percent > 100) {
+		fprintf(stderr, "Number of threads must be in [1, %d], write "
+			"percentage in [0, 100]\n", MAXTHREADS);
+		return 1;
+	}
+
+	printf("%zu iterations per thread, %u%% writes\n", maxcount,
+	       write_percent);
+	for (n = nthreads ? nthreads : 1; n <= (nthreads ? nthreads : MAXTHREADS);
+	     n *= 2) {
+		run("mutex", 0, 0, n, maxcount, write_percent);
+		run("rwlock", 1, 0, n, maxcount, write_percent);
+		run("rwlock-w", 1, RWLOCK_PREFER_WRITER, n, maxcount,
+		    write_percent);
+	}
+
+	assert(rwlock_rdlock(NULL) == -1);
+	assert(rwlock_wrunlock(NULL) == -1);
+
+	return 0;
+}
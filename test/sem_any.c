@@ -0,0 +1,165 @@
+/*
+ * Wait-on-any semaphore test
+ *
+ * The main thread first checks that sem_down_any() takes an available
+ * semaphore right away, and then that it blocks until a second thread releases
+ * one of the semaphores.
+ *
+ * Then, a number of producers release random semaphores out of a set of
+ * sources, while a number of dispatchers take from whichever source is
+ * available with sem_down_any(). Every resource must be taken exactly once,
+ * from the source it was released to. Some of the sources use SEM_HANDOFF, and
+ * the last one is only released to stop the dispatchers.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sem.h>
+
+#define NSOURCES	12
+#define NPRODUCERS	3
+#define NDISPATCHERS	3
+#define MAXCOUNT	3000
+
+struct test {
+	sem_t sources[NSOURCES];
+	atomic_size_t released[NSOURCES];
+	atomic_size_t taken[NSOURCES];
+	size_t maxcount;
+};
+
+struct producer {
+	struct test *t;
+	unsigned int seed;
+};
+
+static void *release_later(void *arg)
+{
+	sem_t sem = (sem_t)arg;
+
+	usleep(10000);
+	printf("thread 2, releasing semaphore\n");
+	sem_up(sem);
+
+	return NULL;
+}
+
+static void *producer(void *arg)
+{
+	struct producer *p = (struct producer*)arg;
+	size_t i, source;
+
+	for (i = 0; i < p->t->maxcount; i++) {
+		source = rand_r(&p->seed) % (NSOURCES - 1);
+		atomic_fetch_add(&p->t->released[source], 1);
+		sem_up(p->t->sources[source]);
+	}
+
+	return NULL;
+}
+
+static void *dispatcher(void *arg)
+{
+	struct test *t = (struct test*)arg;
+	size_t index;
+
+	while (1) {
+		assert(sem_down_any(t->sources, NSOURCES, &index) == 0);
+		assert(index < NSOURCES);
+
+		/* The last source tells the dispatchers to stop */
+		if (index == NSOURCES - 1) {
+			break;
+		}
+		atomic_fetch_add(&t->taken[index], 1);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct producer p[NPRODUCERS];
+	pthread_t prod[NPRODUCERS], disp[NDISPATCHERS], tid;
+	struct test t;
+	sem_t sems[3];
+	size_t i, index;
+	int sval;
+
+	/* Available right away, the first one wins */
+	for (i = 0; i < 3; i++) {
+		sems[i] = sem_create(0);
+	}
+	sem_up(sems[2]);
+	sem_up(sems[1]);
+	assert(sem_down_any(sems, 3, &index) == 0 && index == 1);
+	assert(sem_down_any(sems, 3, &index) == 0 && index == 2);
+
+	/* Blocked until another thread releases one */
+	pthread_create(&tid, NULL, release_later, sems[1]);
+	assert(sem_down_any(sems, 3, &index) == 0 && index == 1);
+	printf("thread 1, took semaphore %zu\n", index);
+	pthread_join(tid, NULL);
+
+	/* All other registrations were cancelled */
+	for (i = 0; i < 3; i++) {
+		sem_getvalue(sems[i], &sval);
+		assert(sval == 0);
+		assert(sem_destroy(sems[i]) == 0);
+	}
+
+	assert(sem_down_any(NULL, 3, &index) == -1);
+	assert(sem_down_any(sems, 0, &index) == -1);
+
+	/* Fan-in from many sources */
+	t.maxcount = MAXCOUNT;
+	if (argc > 1)
+		t.maxcount = strtol(argv[1], NULL, 0);
+
+	for (i = 0; i < NSOURCES; i++) {
+		t.sources[i] = sem_create_flags(0, (i % 3 == 0) ? SEM_HANDOFF
+						: SEM_DEFAULT_FLAGS);
+		atomic_init(&t.released[i], 0);
+		atomic_init(&t.taken[i], 0);
+	}
+
+	for (i = 0; i < NDISPATCHERS; i++) {
+		pthread_create(&disp[i], NULL, dispatcher, &t);
+	}
+	for (i = 0; i < NPRODUCERS; i++) {
+		p[i].t = &t;
+		p[i].seed = i + 1;
+		pthread_create(&prod[i], NULL, producer, &p[i]);
+	}
+
+	/* Wait for the producers, and then for the dispatchers to catch up */
+	for (i = 0; i < NPRODUCERS; i++) {
+		pthread_join(prod[i], NULL);
+	}
+	for (i = 0; i < NSOURCES - 1; i++) {
+		while (atomic_load(&t.taken[i]) != atomic_load(&t.released[i])) {
+			usleep(1000);
+		}
+	}
+
+	/* Stop the dispatchers, and check nothing is left */
+	sem_up_n(t.sources[NSOURCES - 1], NDISPATCHERS);
+	for (i = 0; i < NDISPATCHERS; i++) {
+		pthread_join(disp[i], NULL);
+	}
+
+	for (i = 0; i < NSOURCES; i++) {
+		sem_getvalue(t.sources[i], &sval);
+		assert(sval == 0);
+		assert(sem_destroy(t.sources[i]) == 0);
+	}
+	printf("Dispatched %zu resources\n", NPRODUCERS * t.maxcount);
+
+	return 0;
+}
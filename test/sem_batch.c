@@ -0,0 +1,128 @@
+/*
+ * Batch producer/consumer test
+ *
+ * A producer produces x values at once in a shared buffer, while a consumer
+ * consumes y of these values at once. x and y are always at most half the size
+ * of the buffer, so that they cannot both wait for each other, but can be
+ * different. The synchronization is managed through two semaphores, each batch
+ * being a single sem_down_n()/sem_up_n() operation. The consumer also grabs
+ * whatever else is ready with sem_down_upto().
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sem.h>
+
+#define BUFFER_SIZE	16
+#define BATCH_SIZE	(BUFFER_SIZE / 2)
+#define MAXCOUNT	1000
+
+struct test6 {
+	sem_t empty;
+	sem_t full;
+	size_t head, tail, maxcount;
+	unsigned int prod_seed, cons_seed;
+	unsigned int buffer[BUFFER_SIZE];
+};
+
+#define clamp(x, y) (((x) <= (y)) ? (x) : (y))
+
+static void *consumer(void* arg)
+{
+	struct test6 *t = (struct test6*)arg;
+	size_t i, out = 0;
+
+	while (out < t->maxcount) {
+		size_t n = rand_r(&t->cons_seed) % BATCH_SIZE + 1;
+		int extra;
+
+		n = clamp(n, t->maxcount - out);
+		printf("Consumer wants to get %zu items out of buffer...\n", n);
+		sem_down_n(t->empty, n);
+
+		/* Also take what is already there, without blocking */
+		extra = sem_down_upto(t->empty, t->maxcount - out - n);
+		assert(extra >= 0);
+		n += extra;
+
+		printf("Consumer is taking %zu items out of buffer\n", n);
+		for (i = 0; i < n; i++) {
+			assert(t->buffer[t->tail] == out);
+			out++;
+			t->tail = (t->tail + 1) % BUFFER_SIZE;
+		}
+		sem_up_n(t->full, n);
+	}
+
+	return NULL;
+}
+
+static void *producer(void* arg)
+{
+	struct test6 *t = (struct test6*)arg;
+	size_t i, count = 0;
+
+	while (count < t->maxcount) {
+		size_t n = rand_r(&t->prod_seed) % BATCH_SIZE + 1;
+
+		n = clamp(n, t->maxcount - count);
+		printf("Producer wants to put %zu items into buffer...\n", n);
+		sem_down_n(t->full, n);
+		printf("Producer is putting %zu items into buffer\n", n);
+		for (i = 0; i < n; i++) {
+			t->buffer[t->head] = count++;
+			t->head = (t->head + 1) % BUFFER_SIZE;
+		}
+		sem_up_n(t->empty, n);
+	}
+
+	return NULL;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct test6 t;
+	unsigned int maxcount = MAXCOUNT;
+	pthread_t tid[2];
+
+	t.cons_seed = 1;
+	t.prod_seed = 2;
+
+	if (argc > 1)
+		maxcount = get_argv(argv[1]);
+	if (argc > 2)
+		t.cons_seed = get_argv(argv[2]);
+	if (argc > 3)
+		t.prod_seed = get_argv(argv[3]);
+
+	t.head = t.tail = 0;
+	t.maxcount = maxcount;
+
+	t.empty = sem_create(0);
+	t.full = sem_create(BUFFER_SIZE);
+
+	pthread_create(&tid[0], NULL, producer, &t);
+	pthread_create(&tid[1], NULL, consumer, &t);
+
+	pthread_join(tid[0], NULL);
+	pthread_join(tid[1], NULL);
+
+	sem_destroy(t.empty);
+	sem_destroy(t.full);
+
+	return 0;
+}
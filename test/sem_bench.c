@@ -0,0 +1,151 @@
+/*
+ * Semaphore policy benchmark
+ *
+ * A number of threads (4 by default) repeatedly take and release a semaphore
+ * initialized to 1, i.e. used as a mutex, with a short critical section. The
+ * test is run with every semaphore policy, and reports for each one the
+ * throughput and the average and maximum time spent waiting in sem_down().
+ *
+ * When the library is built with `make STATS=1`, the semaphore's own
+ * contention statistics are reported as well.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+
+#define NTHREADS	4
+#define MAXCOUNT	2000
+#define MAXTHREADS	64
+
+struct bench {
+	sem_t sem;
+	size_t maxcount;
+	size_t counter;
+};
+
+struct result {
+	struct bench *b;
+	double total_wait;
+	double max_wait;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+	struct result *r = (struct result*)arg;
+	struct bench *b = r->b;
+	double start, wait;
+	size_t i;
+
+	for (i = 0; i < b->maxcount; i++) {
+		start = now();
+		sem_down(b->sem);
+		wait = now() - start;
+
+		b->counter++;
+
+		sem_up(b->sem);
+
+		r->total_wait += wait;
+		if (wait > r->max_wait) {
+			r->max_wait = wait;
+		}
+	}
+
+	return NULL;
+}
+
+static void run(const char *name, int flags, size_t nthreads, size_t maxcount)
+{
+	struct result r[MAXTHREADS];
+	pthread_t tid[MAXTHREADS];
+	struct sem_stats stats;
+	struct bench b;
+	double start, elapsed, total_wait = 0, max_wait = 0;
+	size_t i;
+
+	b.sem = sem_create_flags(1, flags);
+	b.maxcount = maxcount;
+	b.counter = 0;
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		r[i].b = &b;
+		r[i].total_wait = r[i].max_wait = 0;
+		pthread_create(&tid[i], NULL, worker, &r[i]);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tid[i], NULL);
+		total_wait += r[i].total_wait;
+		if (r[i].max_wait > max_wait) {
+			max_wait = r[i].max_wait;
+		}
+	}
+	elapsed = now() - start;
+
+	assert(b.counter == nthreads * maxcount);
+
+	printf("%-8s %10.0f ops/s, wait avg %8.2f us, max %10.2f us\n", name,
+	       b.counter / elapsed, total_wait / b.counter * 1e6, max_wait * 1e6);
+
+	if (sem_getstats(b.sem, &stats) == 0) {
+		printf("%-8s %10llu downs, %llu blocked, max %d waiters, "
+		       "wait max %.2f us, histogram:", "",
+		       (unsigned long long)stats.downs,
+		       (unsigned long long)stats.blocked, stats.max_waiters,
+		       stats.wait_max_ns / 1e3);
+		for (i = 0; i < SEM_STATS_BUCKETS; i++) {
+			printf(" %llu", (unsigned long long)stats.wait_hist[i]);
+		}
+		printf("\n");
+	}
+
+	sem_destroy(b.sem);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t nthreads = NTHREADS;
+	size_t maxcount = MAXCOUNT;
+
+	if (argc > 1)
+		nthreads = get_argv(argv[1]);
+	if (argc > 2)
+		maxcount = get_argv(argv[2]);
+
+	if (nthreads < 1 || nthreads > MAXTHREADS) {
+		fprintf(stderr, "Number of threads must be in [1, %d]\n",
+			MAXTHREADS);
+		return 1;
+	}
+
+	printf("%zu threads, %zu iterations each\n", nthreads, maxcount);
+	run("barging", 0, nthreads, maxcount);
+	run("handoff", SEM_HANDOFF, nthreads, maxcount);
+	run("futex", SEM_FUTEX, nthreads, maxcount);
+
+	return 0;
+}
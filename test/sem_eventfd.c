@@ -0,0 +1,103 @@
+/*
+ * Eventfd semaphore test
+ *
+ * The main thread puts a SEM_EVENTFD semaphore in an epoll set, next to a
+ * pipe. It checks that the semaphore is only reported readable while a
+ * resource is available, and then waits on both with epoll_wait() while a
+ * second thread releases the semaphore. Finally, the usual semaphore
+ * operations are checked on the same semaphore.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+
+static void *thread2(void *arg)
+{
+	sem_t sem = (sem_t)arg;
+
+	usleep(10000);
+	printf("thread 2, releasing semaphore\n");
+	sem_up(sem);
+
+	return NULL;
+}
+
+int main(void)
+{
+	struct epoll_event ev, events[2];
+	struct timespec ts;
+	pthread_t tid;
+	sem_t sem;
+	int epfd, pipefd[2], sval;
+
+	sem = sem_create_flags(0, SEM_EVENTFD);
+	assert(sem != NULL);
+	assert(sem_fd(sem) >= 0);
+
+	epfd = epoll_create1(0);
+	assert(pipe(pipefd) == 0);
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = sem;
+	assert(epoll_ctl(epfd, EPOLL_CTL_ADD, sem_fd(sem), &ev) == 0);
+	ev.data.ptr = NULL;
+	assert(epoll_ctl(epfd, EPOLL_CTL_ADD, pipefd[0], &ev) == 0);
+
+	/* Nothing available */
+	assert(epoll_wait(epfd, events, 2, 0) == 0);
+
+	/* Readable while a resource is available */
+	sem_up(sem);
+	assert(epoll_wait(epfd, events, 2, 0) == 1);
+	assert(events[0].data.ptr == sem);
+	assert(sem_trydown(sem) == 0);
+	assert(epoll_wait(epfd, events, 2, 0) == 0);
+
+	/* Woken up by another thread releasing the semaphore */
+	pthread_create(&tid, NULL, thread2, sem);
+	assert(epoll_wait(epfd, events, 2, -1) == 1);
+	assert(events[0].data.ptr == sem);
+	assert(sem_trydown(sem) == 0);
+	printf("thread 1, took semaphore\n");
+	pthread_join(tid, NULL);
+
+	/* Usual operations */
+	assert(sem_trydown(sem) == -1);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += 10000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	assert(sem_timeddown(sem, &ts) == -1);
+
+	sem_up_n(sem, 3);
+	sem_getvalue(sem, &sval);
+	assert(sval == 3);
+	assert(sem_down_n(sem, 2) == -1);
+	assert(sem_down(sem) == 0);
+	assert(sem_down_upto(sem, 5) == 2);
+	sem_getvalue(sem, &sval);
+	assert(sval == 0);
+
+	pthread_create(&tid, NULL, thread2, sem);
+	assert(sem_down(sem) == 0);
+	pthread_join(tid, NULL);
+
+	assert(sem_fd(NULL) == -1);
+	assert(sem_create_flags(0, SEM_EVENTFD | SEM_HANDOFF) == NULL);
+
+	close(epfd);
+	close(pipefd[0]);
+	close(pipefd[1]);
+	assert(sem_destroy(sem) == 0);
+
+	return 0;
+}
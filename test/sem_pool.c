@@ -0,0 +1,148 @@
+/*
+ * Resource pool benchmark
+ *
+ * A number of threads (4 by default) repeatedly take a unit from a pool
+ * semaphore, hold it for a short while, and release it. The test is run with
+ * a large pool, where threads seldom have to wait and sharding avoids bouncing
+ * the count between CPUs, and with a pool smaller than the number of threads,
+ * where threads have to sleep and resources must still flow between shards.
+ * Each configuration is run with and without SEM_SHARDED, and the test checks
+ * that no more units than the pool size are ever in use and that all of them
+ * are back in the pool at the end. It reports the number of operations per
+ * second of each configuration.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sem.h>
+
+#define NTHREADS	4
+#define MAXCOUNT	20000
+#define MAXTHREADS	64
+#define LARGE_POOL	1024
+
+struct pool {
+	sem_t sem;
+	size_t size;
+	size_t maxcount;
+	atomic_size_t in_use;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+	struct pool *p = (struct pool*)arg;
+	volatile size_t work;
+	size_t i, j;
+
+	for (i = 0; i < p->maxcount; i++) {
+		/* Every other round, grab a couple of units at once */
+		if (i % 2) {
+			sem_down(p->sem);
+			assert(atomic_fetch_add(&p->in_use, 1) < p->size);
+			for (work = 0, j = 0; j < 16; j++) {
+				work += j;
+			}
+			atomic_fetch_sub(&p->in_use, 1);
+			sem_up(p->sem);
+		} else if (p->size >= 2) {
+			sem_down_n(p->sem, 2);
+			assert(atomic_fetch_add(&p->in_use, 2) + 2 <= p->size);
+			atomic_fetch_sub(&p->in_use, 2);
+			sem_up_n(p->sem, 2);
+		}
+	}
+
+	return NULL;
+}
+
+static void run(const char *name, int flags, size_t size, size_t nthreads,
+		size_t maxcount)
+{
+	pthread_t tid[MAXTHREADS];
+	struct pool p;
+	double start, elapsed;
+	size_t i;
+	int sval;
+
+	p.sem = sem_create_flags(size, flags);
+	assert(p.sem != NULL);
+	p.size = size;
+	p.maxcount = maxcount;
+	atomic_init(&p.in_use, 0);
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		pthread_create(&tid[i], NULL, worker, &p);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tid[i], NULL);
+	}
+	elapsed = now() - start;
+
+	sem_getvalue(p.sem, &sval);
+	assert((size_t)sval == size);
+	assert(sem_down_upto(p.sem, size + 1) == (int)size);
+	sem_getvalue(p.sem, &sval);
+	assert(sval == 0);
+	sem_up_n(p.sem, size);
+
+	printf("%-8s pool %5zu %10.0f ops/s\n", name, size,
+	       nthreads * maxcount / elapsed);
+
+	assert(sem_destroy(p.sem) == 0);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t nthreads = NTHREADS;
+	size_t maxcount = MAXCOUNT;
+
+	if (argc > 1)
+		nthreads = get_argv(argv[1]);
+	if (argc > 2)
+		maxcount = get_argv(argv[2]);
+
+	if (nthreads < 1 || nthreads > MAXTHREADS) {
+		fprintf(stderr, "Number of threads must be in [1, %d]\n",
+			MAXTHREADS);
+		return 1;
+	}
+
+	run("single", 0, LARGE_POOL, nthreads, maxcount);
+	run("sharded", SEM_SHARDED, LARGE_POOL, nthreads, maxcount);
+	run("futex", SEM_SHARDED | SEM_FUTEX, LARGE_POOL, nthreads, maxcount);
+
+	run("single", 0, 2, nthreads, maxcount);
+	run("sharded", SEM_SHARDED, 2, nthreads, maxcount);
+	run("futex", SEM_SHARDED | SEM_FUTEX, 2, nthreads, maxcount);
+	run("sharded", SEM_SHARDED, 1, nthreads, maxcount);
+
+	assert(sem_create_flags(1, SEM_SHARDED | SEM_HANDOFF) == NULL);
+	assert(sem_create_flags(1, SEM_SHARDED | SEM_EVENTFD) == NULL);
+
+	return 0;
+}
@@ -6,6 +6,8 @@
  * pipeline consists of filtering thread, added dynamically each time a new
  * prime number is found and which filters out subsequent numbers that are
  * multiples of that prime.
+ *
+ * Each channel embeds its two semaphores, initialized with sem_init().
  */
 
 #include <limits.h>
@@ -20,8 +22,8 @@
 
 struct channel {
 	int value;
-	sem_t produce;
-	sem_t consume;
+	struct semaphore produce;
+	struct semaphore consume;
 };
 
 struct filter {
@@ -42,14 +44,14 @@ static void *source(void *arg)
 
 	for (i = 2; i <= max; i++) {
 		c->value = i;
-		sem_up(c->consume);
-		sem_down(c->produce);
+		sem_up(&c->consume);
+		sem_down(&c->produce);
 	}
 
 	/* mark completion */
 	c->value = -1;
-	sem_up(c->consume);
-	sem_down(c->produce);
+	sem_up(&c->consume);
+	sem_down(&c->produce);
 
 	return NULL;
 }
@@ -61,13 +63,13 @@ static void *filter(void *arg)
 	int value;
 
 	while (1) {
-		sem_down(f->left->consume);
+		sem_down(&f->left->consume);
 		value = f->left->value;
-		sem_up(f->left->produce);
+		sem_up(&f->left->produce);
 		if ((value == -1) || (value % f->prime != 0)) {
 			f->right->value = value;
-			sem_up(f->right->consume);
-			sem_down(f->right->produce);
+			sem_up(&f->right->consume);
+			sem_down(&f->right->produce);
 		}
 		if (value == -1)
 			break;
@@ -87,17 +89,17 @@ static void *sink(void *arg)
 	init_p = malloc(sizeof(*init_p));
 
 	p = init_p;
-	p->produce = sem_create(0);
-	p->consume = sem_create(0);
+	sem_init(&p->produce, 0);
+	sem_init(&p->consume, 0);
 
 	pthread_create(&tid, NULL, source, p);
 
 	while (1) {
 		struct filter *f;
 
-		sem_down(p->consume);
+		sem_down(&p->consume);
 		value = p->value;
-		sem_up(p->produce);
+		sem_up(&p->produce);
 
 		if (value == -1)
 			break;
@@ -110,8 +112,8 @@ static void *sink(void *arg)
 		f->next = NULL;
 
 		p = malloc(sizeof(*p));
-		p->produce = sem_create(0);
-		p->consume = sem_create(0);
+		sem_init(&p->produce, 0);
+		sem_init(&p->consume, 0);
 
 		f->right = p;
 
@@ -123,19 +125,23 @@ static void *sink(void *arg)
 	}
 
 	pthread_join(tid, NULL);
-	sem_destroy(init_p->produce);
-	sem_destroy(init_p->consume);
 
 	while (f_head) {
 		struct filter *old = f_head;
 
 		pthread_join(f_head->tid, NULL);
-		sem_destroy(f_head->right->produce);
-		sem_destroy(f_head->right->consume);
+		sem_fini(&f_head->right->produce);
+		sem_fini(&f_head->right->consume);
+		free(f_head->right);
 		f_head = f_head->next;
 		free(old);
 	}
 
+	/* The first filter reads from the source's channel until it exits */
+	sem_fini(&init_p->produce);
+	sem_fini(&init_p->consume);
+	free(init_p);
+
 	return NULL;
 }
 
@@ -0,0 +1,171 @@
+/*
+ * Process-shared semaphore test
+ *
+ * A few semaphores are created with sem_create_shared() in an anonymous
+ * MAP_SHARED mapping, which forked child processes inherit. A number of child
+ * processes (4 by default) then increment a counter in the same mapping, using
+ * one of the semaphores as a mutex, and the parent checks the total once they
+ * have all exited.
+ *
+ * The parent then bounces a token back and forth with a child process through
+ * two semaphores, and reports the number of round trips per second, as well as
+ * the number of uncontended sem_down()/sem_up() pairs per second compared to a
+ * private semaphore.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+
+#define NPROCS		4
+#define MAXCOUNT	20000
+#define MAXPROCS	64
+
+struct shared {
+	struct semaphore mutex;
+	struct semaphore ping;
+	struct semaphore pong;
+	size_t counter;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void increment(sem_t mutex, struct shared *shm, size_t maxcount)
+{
+	size_t i;
+
+	for (i = 0; i < maxcount; i++) {
+		sem_down(mutex);
+		shm->counter++;
+		sem_up(mutex);
+	}
+}
+
+static double uncontended(sem_t sem, size_t maxcount)
+{
+	double start = now();
+	size_t i;
+
+	for (i = 0; i < maxcount; i++) {
+		sem_down(sem);
+		sem_up(sem);
+	}
+
+	return maxcount / (now() - start);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t nprocs = NPROCS;
+	size_t maxcount = MAXCOUNT;
+	struct shared *shm;
+	sem_t mutex, ping, pong, private;
+	double start, elapsed;
+	pid_t pid;
+	size_t i;
+	int status, sval;
+
+	if (argc > 1)
+		nprocs = get_argv(argv[1]);
+	if (argc > 2)
+		maxcount = get_argv(argv[2]);
+
+	if (nprocs < 1 || nprocs > MAXPROCS) {
+		fprintf(stderr, "Number of processes must be in [1, %d]\n",
+			MAXPROCS);
+		return 1;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(shm != MAP_FAILED);
+
+	mutex = sem_create_shared(&shm->mutex, sizeof(shm->mutex), 1);
+	ping = sem_create_shared(&shm->ping, sizeof(shm->ping), 0);
+	pong = sem_create_shared(&shm->pong, sizeof(shm->pong), 0);
+	assert(mutex != NULL && ping != NULL && pong != NULL);
+	shm->counter = 0;
+
+	/* Mutual exclusion across processes */
+	for (i = 0; i < nprocs; i++) {
+		pid = fork();
+		assert(pid != -1);
+		if (pid == 0) {
+			increment(mutex, shm, maxcount);
+			_exit(0);
+		}
+	}
+	for (i = 0; i < nprocs; i++) {
+		assert(wait(&status) != -1);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	assert(shm->counter == nprocs * maxcount);
+	sem_getvalue(mutex, &sval);
+	assert(sval == 1);
+	printf("%zu processes, counter %zu\n", nprocs, shm->counter);
+
+	/* Ping-pong with a child process, which has to sleep every time */
+	pid = fork();
+	assert(pid != -1);
+	if (pid == 0) {
+		for (i = 0; i < maxcount; i++) {
+			sem_down(ping);
+			sem_up(pong);
+		}
+		_exit(0);
+	}
+
+	start = now();
+	for (i = 0; i < maxcount; i++) {
+		sem_up(ping);
+		sem_down(pong);
+	}
+	elapsed = now() - start;
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	printf("%-8s %10.0f round trips/s\n", "ping", maxcount / elapsed);
+
+	/* The fast path does not depend on where the semaphore lives */
+	private = sem_create(1);
+	printf("%-8s %10.0f down/up/s\n", "shared",
+	       uncontended(mutex, maxcount));
+	printf("%-8s %10.0f down/up/s\n", "private",
+	       uncontended(private, maxcount));
+	assert(sem_destroy(private) == 0);
+
+	/* Corner cases */
+	assert(sem_create_shared(NULL, sizeof(struct semaphore), 0) == NULL);
+	assert(sem_create_shared(shm, sizeof(struct semaphore) - 1, 0) == NULL);
+	assert(sem_create_shared((char *)shm + 1, sizeof(*shm), 0) == NULL);
+	assert(sem_down_any(&mutex, 1, &i) == -1);
+
+	assert(sem_fini(ping) == 0);
+	assert(sem_fini(pong) == 0);
+	assert(sem_destroy(mutex) == 0);
+	munmap(shm, sizeof(*shm));
+
+	return 0;
+}
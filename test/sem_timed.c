@@ -0,0 +1,93 @@
+/*
+ * Non-blocking and timed semaphore test
+ *
+ * The main thread checks that sem_trydown() and sem_timeddown() fail on an
+ * unavailable semaphore, and that a timed out thread does not consume any
+ * resource. A second thread then releases the semaphore while the main thread
+ * is waiting with a deadline far enough in the future. Finally, the same checks
+ * are done on a statically initialized semaphore.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+
+static struct semaphore static_sem = SEM_INITIALIZER(1);
+
+/* Build a deadline @ms milliseconds from now */
+static void deadline(struct timespec *ts, long ms)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static void *thread2(void *arg)
+{
+	sem_t sem = (sem_t)arg;
+
+	usleep(10000);
+	printf("thread 2, releasing semaphore\n");
+	sem_up(sem);
+
+	return NULL;
+}
+
+int main(void)
+{
+	struct timespec ts;
+	pthread_t tid;
+	sem_t sem;
+	int sval;
+
+	sem = sem_create(0);
+
+	/* Nothing available */
+	assert(sem_trydown(sem) == -1);
+	deadline(&ts, 10);
+	assert(sem_timeddown(sem, &ts) == -1);
+	printf("thread 1, timed out\n");
+
+	/* A timed out thread must have left the waiting list */
+	sem_getvalue(sem, &sval);
+	assert(sval == 0);
+
+	/* Resources available right away */
+	sem_up(sem);
+	assert(sem_trydown(sem) == 0);
+	sem_up(sem);
+	deadline(&ts, 0);
+	assert(sem_timeddown(sem, &ts) == 0);
+
+	/* Resource released before the deadline */
+	pthread_create(&tid, NULL, thread2, sem);
+	deadline(&ts, 10000);
+	assert(sem_timeddown(sem, &ts) == 0);
+	printf("thread 1, took semaphore\n");
+	pthread_join(tid, NULL);
+
+	assert(sem_trydown(NULL) == -1);
+	assert(sem_timeddown(sem, NULL) == -1);
+	assert(sem_destroy(sem) == 0);
+
+	/* Statically initialized semaphore */
+	assert(sem_trydown(&static_sem) == 0);
+	assert(sem_trydown(&static_sem) == -1);
+	deadline(&ts, 10);
+	assert(sem_timeddown(&static_sem, &ts) == -1);
+	sem_up(&static_sem);
+	sem_getvalue(&static_sem, &sval);
+	assert(sval == 1);
+	assert(sem_fini(&static_sem) == 0);
+
+	return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * TPS scalability test
+ *
+ * A large number of threads (1000 by default) each create a TPS, and wait at a
+ * barrier until all of them have one. Every thread then repeatedly writes its
+ * own identifier to its TPS and reads it back, while odd threads first clone
+ * the TPS of the thread before them, so that both threads share a page until
+ * their first write. The test reports the number of TPS accesses per second of
+ * CPU time spent accessing, which should not depend much on the number of
+ * threads with a TPS.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <barrier.h>
+#include <tps.h>
+
+#define NTHREADS	1000
+#define MAXCOUNT	100
+#define STACK_SIZE	(64 * 1024)
+
+struct test {
+	size_t nthreads, maxcount;
+	pthread_t *tids;
+	barrier_t created, cloned, done;
+};
+
+struct worker {
+	struct test *t;
+	size_t id;
+	double elapsed;
+};
+
+/* CPU time of the calling thread */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = (struct worker*)arg;
+	struct test *t = w->t;
+	double start;
+	size_t i, id;
+
+	/* Even threads create a TPS, odd threads clone their neighbor's */
+	if (w->id % 2 == 0) {
+		assert(tps_create() == 0);
+		assert(tps_write(0, sizeof(w->id), (char*)&w->id) == 0);
+	}
+	barrier_wait(t->created);
+	if (w->id % 2 == 1) {
+		assert(tps_clone(t->tids[w->id - 1]) == 0);
+		assert(tps_read(0, sizeof(id), (char*)&id) == 0);
+		assert(id == w->id - 1);
+	}
+	barrier_wait(t->cloned);
+
+	start = now();
+	for (i = 0; i < t->maxcount; i++) {
+		assert(tps_write(0, sizeof(w->id), (char*)&w->id) == 0);
+		assert(tps_read(0, sizeof(id), (char*)&id) == 0);
+		assert(id == w->id);
+	}
+	w->elapsed = now() - start;
+
+	barrier_wait(t->done);
+	assert(tps_destroy() == 0);
+	assert(tps_destroy() == -1);
+
+	return NULL;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *w;
+	pthread_attr_t attr;
+	struct test t;
+	double elapsed = 0;
+	size_t i;
+
+	t.nthreads = NTHREADS;
+	t.maxcount = MAXCOUNT;
+	if (argc > 1)
+		t.nthreads = get_argv(argv[1]);
+	if (argc > 2)
+		t.maxcount = get_argv(argv[2]);
+
+	if (t.nthreads < 2 || t.nthreads % 2) {
+		fprintf(stderr, "Number of threads must be even\n");
+		return 1;
+	}
+
+	tps_init(1);
+
+	t.tids = malloc(t.nthreads * sizeof(pthread_t));
+	w = malloc(t.nthreads * sizeof(struct worker));
+	t.created = barrier_create(t.nthreads, BARRIER_TREE);
+	t.cloned = barrier_create(t.nthreads, BARRIER_TREE);
+	t.done = barrier_create(t.nthreads + 1, BARRIER_TREE);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, STACK_SIZE);
+
+	for (i = 0; i < t.nthreads; i++) {
+		w[i].t = &t;
+		w[i].id = i;
+		assert(pthread_create(&t.tids[i], &attr, worker, &w[i]) == 0);
+	}
+
+	barrier_wait(t.done);
+
+	for (i = 0; i < t.nthreads; i++) {
+		pthread_join(t.tids[i], NULL);
+		elapsed += w[i].elapsed;
+	}
+
+	printf("%zu threads %10.0f accesses/s\n", t.nthreads,
+	       2 * t.nthreads * t.maxcount / elapsed);
+
+	pthread_attr_destroy(&attr);
+	barrier_destroy(t.created);
+	barrier_destroy(t.cloned);
+	barrier_destroy(t.done);
+	free(w);
+	free(t.tids);
+
+	return 0;
+}
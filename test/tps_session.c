@@ -0,0 +1,248 @@
+/*
+ * TPS session test
+ *
+ * The main thread keeps a structure of counters in its TPS, and updates them
+ * through the pointer returned by tps_begin(), checking the result with
+ * tps_read() once the session is over. It then checks the error cases of the
+ * session API, and that tps_read() and tps_write() keep working within a
+ * session, and that a thread cloning the TPS during a session waits for it
+ * without holding up other threads. Another thread clones the TPS, writes a
+ * single page of its copy, and opens a session on it, which must see its write
+ * but not the ones the main thread makes in the meantime.
+ *
+ * Finally, the test reports the number of counter updates per second done with
+ * tps_read() and tps_write(), and done within a single session.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <tps.h>
+
+#define NCOUNTERS	100
+#define MAXCOUNT	10000
+#define TPS_PAGES	4
+
+struct counters {
+	size_t value[NCOUNTERS];
+	char padding[TPS_PAGES * TPS_SIZE - NCOUNTERS * sizeof(size_t)];
+};
+
+static sem_t sem1, sem2;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *thread2(void *arg)
+{
+	pthread_t tid = *(pthread_t*)arg;
+	struct counters *c;
+	size_t value = 42;
+
+	/* Scatter the pages of the clone with a copy on write of one page */
+	assert(tps_clone(tid) == 0);
+	assert(tps_write(2 * TPS_SIZE, sizeof(value), (char*)&value) == 0);
+	sem_up(sem1);
+	sem_down(sem2);
+
+	/* The session sees the whole area, with its own write only */
+	c = tps_begin(TPS_READ);
+	assert(c != NULL);
+	assert(c->value[0] == 1);
+	assert(c->value[NCOUNTERS - 1] == NCOUNTERS);
+	assert(!memcmp(&c->padding[2 * TPS_SIZE - sizeof(c->value)], &value,
+		       sizeof(value)));
+	assert(tps_end() == 0);
+
+	/* And can write all of it */
+	c = tps_begin(TPS_READ | TPS_WRITE);
+	assert(c != NULL);
+	c->value[0] = 0;
+	assert(tps_end() == 0);
+	printf("thread2: session OK!\n");
+
+	assert(tps_destroy() == 0);
+	return NULL;
+}
+
+static void *cloner(void *arg)
+{
+	pthread_t tid = *(pthread_t*)arg;
+	size_t value;
+
+	assert(tps_clone(tid) == 0);
+	assert(tps_read(0, sizeof(value), (char*)&value) == 0);
+	assert(value == 1);
+	assert(tps_destroy() == 0);
+
+	return NULL;
+}
+
+static void *creator(void *arg)
+{
+	assert(tps_create() == 0);
+	assert(tps_destroy() == 0);
+
+	return NULL;
+}
+
+static void check_session(void)
+{
+	struct counters *c;
+	size_t i, value;
+	pthread_t self, tid, other;
+
+	/* Direct access to the counters */
+	c = tps_begin(TPS_READ | TPS_WRITE);
+	assert(c != NULL);
+	for (i = 0; i < NCOUNTERS; i++) {
+		c->value[i] = i + 1;
+	}
+	assert(tps_end() == 0);
+
+	assert(tps_read(0, sizeof(value), (char*)&value) == 0);
+	assert(value == 1);
+	assert(tps_read((NCOUNTERS - 1) * sizeof(value), sizeof(value),
+			(char*)&value) == 0);
+	assert(value == NCOUNTERS);
+
+	/* One session at a time, and no writing in a read session */
+	c = tps_begin(TPS_READ);
+	assert(c != NULL);
+	assert(tps_begin(TPS_READ) == NULL);
+	assert(tps_destroy() == -1);
+	assert(tps_read(sizeof(value), sizeof(value), (char*)&value) == 0);
+	assert(value == 2);
+	assert(tps_write(0, sizeof(value), (char*)&value) == -1);
+	assert(tps_read(sizeof(*c), 1, (char*)&value) == -1);
+	assert(tps_end() == 0);
+	assert(tps_end() == -1);
+
+	/* Reads and writes within a write session */
+	c = tps_begin(TPS_READ | TPS_WRITE);
+	assert(c != NULL);
+	value = 7;
+	assert(tps_write(sizeof(value), sizeof(value), (char*)&value) == 0);
+	assert(c->value[1] == 7);
+	c->value[1] = 2;
+	assert(tps_read(sizeof(value), sizeof(value), (char*)&value) == 0);
+	assert(value == 2);
+	assert(tps_end() == 0);
+
+	assert(tps_begin(0) == NULL);
+	assert(tps_begin(0x4) == NULL);
+	assert(tps_begin(TPS_WRITE) == NULL);
+
+	/* A clone waits for the session, but other threads do not */
+	c = tps_begin(TPS_READ);
+	assert(c != NULL);
+	self = pthread_self();
+	pthread_create(&tid, NULL, cloner, &self);
+	usleep(10000);
+	pthread_create(&other, NULL, creator, NULL);
+	pthread_join(other, NULL);
+	assert(tps_end() == 0);
+	pthread_join(tid, NULL);
+
+	/* Sessions on a clone */
+	self = pthread_self();
+	pthread_create(&tid, NULL, thread2, &self);
+	sem_down(sem1);
+
+	c = tps_begin(TPS_READ | TPS_WRITE);
+	assert(c != NULL);
+	c->value[NCOUNTERS - 1] = 0;
+	assert(tps_end() == 0);
+
+	sem_up(sem2);
+	pthread_join(tid, NULL);
+
+	assert(tps_read(0, sizeof(value), (char*)&value) == 0);
+	assert(value == 1);
+	printf("thread1: session OK!\n");
+}
+
+static void bench(size_t maxcount)
+{
+	struct counters *c;
+	double start, elapsed;
+	size_t i, j, value;
+
+	/* Read-modify-write of every counter, through the API */
+	start = now();
+	for (i = 0; i < maxcount; i++) {
+		for (j = 0; j < NCOUNTERS; j++) {
+			tps_read(j * sizeof(value), sizeof(value),
+				 (char*)&value);
+			value++;
+			tps_write(j * sizeof(value), sizeof(value),
+				  (char*)&value);
+		}
+	}
+	elapsed = now() - start;
+	printf("%-8s %10.0f updates/s\n", "api", maxcount * NCOUNTERS / elapsed);
+
+	/* The same within one session per batch of counters */
+	start = now();
+	for (i = 0; i < maxcount; i++) {
+		c = tps_begin(TPS_READ | TPS_WRITE);
+		for (j = 0; j < NCOUNTERS; j++) {
+			c->value[j]++;
+		}
+		tps_end();
+	}
+	elapsed = now() - start;
+	printf("%-8s %10.0f updates/s\n", "session",
+	       maxcount * NCOUNTERS / elapsed);
+
+	assert(tps_read(0, sizeof(value), (char*)&value) == 0);
+	assert(value == 1 + 2 * maxcount);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t maxcount = MAXCOUNT;
+
+	if (argc > 1)
+		maxcount = get_argv(argv[1]);
+
+	sem1 = sem_create(0);
+	sem2 = sem_create(0);
+
+	tps_init(1);
+
+	assert(tps_begin(TPS_READ) == NULL);
+	assert(tps_end() == -1);
+
+	assert(tps_create_sized(sizeof(struct counters)) == 0);
+	check_session();
+	bench(maxcount);
+	assert(tps_destroy() == 0);
+
+	sem_destroy(sem1);
+	sem_destroy(sem2);
+
+	return 0;
+}
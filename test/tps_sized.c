@@ -0,0 +1,192 @@
+/*
+ * Sized TPS test
+ *
+ * The main thread creates a multi-page TPS, fills it, and checks that accesses
+ * are only allowed within its bounds. A second thread then clones it, checks
+ * the whole content, and writes to the end of its copy and across a page
+ * boundary, which must neither disturb the rest of its copy nor be seen by the
+ * main thread, while a third thread cloning the copy must see them. Finally,
+ * the main thread does the same checks with an area large enough to use huge
+ * pages, which a fourth thread clones and writes to.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sem.h>
+#include <tps.h>
+
+#define SMALL_SIZE	(64 * 1024)
+#define LARGE_SIZE	(2 * 1024 * 1024 + 1)
+
+static sem_t sem1, sem2;
+
+static void fill(char *buffer, size_t size, char c)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		buffer[i] = c + i % 64;
+	}
+}
+
+static void check_area(size_t size)
+{
+	char *buffer = malloc(size + TPS_SIZE);
+	char *expected = malloc(size);
+
+	fill(expected, size, 'A');
+	assert(tps_write(0, size, expected) == 0);
+
+	memset(buffer, 0, size);
+	assert(tps_read(0, size, buffer) == 0);
+	assert(!memcmp(buffer, expected, size));
+
+	/* Accesses must stay within the area, rounded up to whole pages */
+	size = (size + TPS_SIZE - 1) / TPS_SIZE * TPS_SIZE;
+	assert(tps_read(size - 1, 1, buffer) == 0);
+	assert(tps_write(size - 1, 1, buffer) == 0);
+	assert(tps_read(size, 1, buffer) == -1);
+	assert(tps_read(size - 1, 2, buffer) == -1);
+	assert(tps_write(size - 1, 2, buffer) == -1);
+	assert(tps_read(1, (size_t)-1, buffer) == -1);
+	assert(tps_read(0, size + 1, buffer) == -1);
+
+	free(buffer);
+	free(expected);
+}
+
+/* Clone of thread2's copy, which must include its writes */
+static void *thread3(void *arg)
+{
+	pthread_t tid = *(pthread_t*)arg;
+	char *buffer = malloc(SMALL_SIZE);
+	char *expected = malloc(SMALL_SIZE);
+
+	assert(tps_clone(tid) == 0);
+	assert(tps_read(0, SMALL_SIZE, buffer) == 0);
+
+	fill(expected, SMALL_SIZE, 'A');
+	memcpy(expected + TPS_SIZE - 2, "yyyy", 4);
+	memcpy(expected + SMALL_SIZE - 4, "zzzz", 4);
+	assert(!memcmp(buffer, expected, SMALL_SIZE));
+	printf("thread3: read OK!\n");
+
+	assert(tps_destroy() == 0);
+	free(buffer);
+	free(expected);
+
+	return NULL;
+}
+
+static void *thread2(void *arg)
+{
+	pthread_t tid = *(pthread_t*)arg;
+	char *buffer = malloc(SMALL_SIZE);
+	char *expected = malloc(SMALL_SIZE);
+	pthread_t self, tid3;
+
+	/* The clone covers the whole area */
+	assert(tps_clone(tid) == 0);
+	fill(expected, SMALL_SIZE, 'A');
+	assert(tps_read(0, SMALL_SIZE, buffer) == 0);
+	assert(!memcmp(buffer, expected, SMALL_SIZE));
+	printf("thread2: read OK!\n");
+
+	/* Copy on write at the end of the area */
+	assert(tps_write(SMALL_SIZE - 4, 4, "zzzz") == 0);
+	assert(tps_read(SMALL_SIZE - 8, 8, buffer) == 0);
+	assert(!memcmp(buffer, expected + SMALL_SIZE - 8, 4));
+	assert(!memcmp(buffer + 4, "zzzz", 4));
+
+	/* Copy on write of two pages at once, the rest being untouched */
+	assert(tps_write(TPS_SIZE - 2, 4, "yyyy") == 0);
+	assert(tps_read(0, SMALL_SIZE, buffer) == 0);
+	assert(!memcmp(buffer + TPS_SIZE - 2, "yyyy", 4));
+	assert(!memcmp(buffer, expected, TPS_SIZE - 2));
+	assert(!memcmp(buffer + TPS_SIZE + 2, expected + TPS_SIZE + 2,
+		       SMALL_SIZE - TPS_SIZE - 12));
+
+	self = pthread_self();
+	pthread_create(&tid3, NULL, thread3, &self);
+	pthread_join(tid3, NULL);
+
+	sem_up(sem1);
+	sem_down(sem2);
+
+	assert(tps_destroy() == 0);
+	free(buffer);
+	free(expected);
+
+	return NULL;
+}
+
+/* Copy on write of a single huge page of the main thread's large area */
+static void *thread4(void *arg)
+{
+	pthread_t tid = *(pthread_t*)arg;
+	char buffer[4];
+
+	assert(tps_clone(tid) == 0);
+	assert(tps_write(LARGE_SIZE - 4, 4, "zzzz") == 0);
+	assert(tps_read(LARGE_SIZE - 4, 4, buffer) == 0);
+	assert(!memcmp(buffer, "zzzz", 4));
+	assert(tps_read(0, 4, buffer) == 0);
+	assert(!memcmp(buffer, "ABCD", 4));
+	assert(tps_destroy() == 0);
+
+	return NULL;
+}
+
+int main(void)
+{
+	char *buffer = malloc(SMALL_SIZE);
+	char *expected = malloc(SMALL_SIZE);
+	pthread_t self, tid;
+
+	sem1 = sem_create(0);
+	sem2 = sem_create(0);
+
+	tps_init(1);
+
+	assert(tps_create_sized(0) == -1);
+	assert(tps_create_sized(SMALL_SIZE) == 0);
+	assert(tps_create_sized(SMALL_SIZE) == -1);
+	assert(tps_create() == -1);
+	check_area(SMALL_SIZE);
+
+	/* The clone's write is not seen here */
+	self = pthread_self();
+	pthread_create(&tid, NULL, thread2, &self);
+	sem_down(sem1);
+
+	fill(expected, SMALL_SIZE, 'A');
+	assert(tps_read(0, SMALL_SIZE, buffer) == 0);
+	assert(!memcmp(buffer, expected, SMALL_SIZE));
+	printf("thread1: read OK!\n");
+
+	sem_up(sem2);
+	pthread_join(tid, NULL);
+	assert(tps_destroy() == 0);
+
+	/* Huge page sized area */
+	assert(tps_create_sized(LARGE_SIZE) == 0);
+	check_area(LARGE_SIZE);
+	pthread_create(&tid, NULL, thread4, &self);
+	pthread_join(tid, NULL);
+	fill(expected, SMALL_SIZE, 'A');
+	assert(tps_read(LARGE_SIZE - 4, 4, buffer) == 0);
+	assert(!memcmp(buffer, expected + (LARGE_SIZE - 4) % 64, 4));
+	assert(tps_destroy() == 0);
+	printf("thread1: large area OK!\n");
+
+	sem_destroy(sem1);
+	sem_destroy(sem2);
+	free(buffer);
+	free(expected);
+
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * TPS stress test
+ *
+ * The main thread keeps rewriting the whole of its multi-page TPS with a single
+ * tps_write(), or within a write session, and every byte of the area always
+ * holds the same value. Meanwhile, several threads (4 by default) repeatedly
+ * clone it, check that their copy holds a single value, write to one page of it
+ * and destroy it, so that pages are copied on write, swapped and freed by some
+ * threads while others are cloning them.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tps.h>
+
+#define NCLONERS	4
+#define MAXCOUNT	2000
+#define TPS_PAGES	8
+#define AREA_SIZE	(TPS_PAGES * TPS_SIZE)
+
+struct test {
+	pthread_t owner;
+	size_t maxcount;
+	atomic_size_t running;
+};
+
+/* Check that the @size bytes of @buffer all hold the same value */
+static void check_uniform(char *buffer, size_t size)
+{
+	size_t i;
+
+	for (i = 1; i < size; i++) {
+		assert(buffer[i] == buffer[0]);
+	}
+}
+
+static void *cloner(void *arg)
+{
+	struct test *t = arg;
+	char *buffer = malloc(AREA_SIZE);
+	size_t i, page;
+
+	for (i = 0; i < t->maxcount; i++) {
+		assert(tps_clone(t->owner) == 0);
+
+		/* The clone never sees a write of the owner half done */
+		assert(tps_read(0, AREA_SIZE, buffer) == 0);
+		check_uniform(buffer, AREA_SIZE);
+
+		/* Copy on write of one page, the others staying shared */
+		page = i % TPS_PAGES;
+		memset(buffer, ~buffer[0], TPS_SIZE);
+		assert(tps_write(page * TPS_SIZE, TPS_SIZE, buffer) == 0);
+		assert(tps_read(page * TPS_SIZE, TPS_SIZE, buffer) == 0);
+		check_uniform(buffer, TPS_SIZE);
+
+		assert(tps_destroy() == 0);
+	}
+
+	atomic_fetch_sub(&t->running, 1);
+	free(buffer);
+
+	return NULL;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct test t;
+	size_t ncloners = NCLONERS, i, value;
+	pthread_t *tids;
+	char *buffer, *area;
+
+	t.maxcount = MAXCOUNT;
+	if (argc > 1)
+		ncloners = get_argv(argv[1]);
+	if (argc > 2)
+		t.maxcount = get_argv(argv[2]);
+
+	tids = malloc(ncloners * sizeof(pthread_t));
+	buffer = malloc(AREA_SIZE);
+
+	tps_init(1);
+	assert(tps_create_sized(AREA_SIZE) == 0);
+
+	t.owner = pthread_self();
+	atomic_init(&t.running, ncloners);
+	for (i = 0; i < ncloners; i++) {
+		pthread_create(&tids[i], NULL, cloner, &t);
+	}
+
+	/* Rewrite the whole area until all the cloners are done */
+	for (value = 0; atomic_load(&t.running) > 0; value++) {
+		if (value % 16 == 0) {
+			area = tps_begin(TPS_READ | TPS_WRITE);
+			assert(area != NULL);
+			memset(area, value, AREA_SIZE);
+			assert(tps_end() == 0);
+		} else {
+			memset(buffer, value, AREA_SIZE);
+			assert(tps_write(0, AREA_SIZE, buffer) == 0);
+		}
+	}
+
+	for (i = 0; i < ncloners; i++) {
+		pthread_join(tids[i], NULL);
+	}
+
+	assert(tps_read(0, AREA_SIZE, buffer) == 0);
+	check_uniform(buffer, AREA_SIZE);
+	assert(tps_destroy() == 0);
+	printf("stress: %zu clones by %zu threads, %zu writes OK!\n",
+	       ncloners * t.maxcount, ncloners, value);
+
+	free(tids);
+	free(buffer);
+
+	return 0;
+}
@@ -228,6 +228,15 @@ void clone_test(void)
 	/* Clone the helper threads tps */
 	tps_clone(tid);
 
+#ifdef TPS_MEMFD
+	/*
+	 * With memfd areas, the clone is a private mapping of the helper's file
+	 * and the kernel copies on write, so only the clone maps memory
+	 */
+	assert(old_mmap_addr != latest_mmap_addr);
+	old_mmap_addr = latest_mmap_addr;
+#endif
+
 	/* Check cloned properly, and no new memory is allocated after read */
 	tps_read(0,TPS_SIZE,buffer);
 	assert(strcmp(buffer,msg1) == 0);
@@ -248,7 +257,11 @@ void clone_test(void)
 	/* Confirm Copy on Write */
 	tps_read(0, TPS_SIZE, buffer);
 	assert(strcmp(buffer,msg2) == 0);
+#ifndef TPS_MEMFD
 	assert(old_mmap_addr != latest_mmap_addr);
+#else
+	assert(old_mmap_addr == latest_mmap_addr);
+#endif
 
 	tps_destroy();
 